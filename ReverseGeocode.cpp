@@ -1,87 +1,146 @@
-#include "ReverseGeocode.hpp" 
-#include <iostream>
-#include <exception>
+#include "ReverseGeocode.hpp"
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Layout written by places-pack.py
+struct ReverseGeocode::header
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t place_count;
+  uint32_t text_size;
+};
+
+struct ReverseGeocode::place
+{
+  float xyz[3];
+  int32_t lat;
+  int32_t lon;
+  uint32_t text;
+  char cc[2];
+  char reserved[2];
+};
+
+namespace
+{
+  constexpr uint32_t places_version = 1;
+
+  // Installed by make install. The one in the current directory is used when testing from the build directory.
+  const char *const places_files[] = { "/usr/local/share/tesla-cron/places.bin", "places.bin" };
+
+  // Same earth centered coordinates as reverse_geocoder, so the same place is found
+  void ecef(double lat, double lon, double xyz[3])
+  {
+    const double a = 6378.137;
+    const double e2 = 0.00669437999014;
+    lat = lat * M_PI / 180;
+    lon = lon * M_PI / 180;
+    const double normal = a / std::sqrt(1 - e2 * std::sin(lat) * std::sin(lat));
+    xyz[0] = normal * std::cos(lat) * std::cos(lon);
+    xyz[1] = normal * std::cos(lat) * std::sin(lon);
+    xyz[2] = normal * (1 - e2) * std::sin(lat);
+  }
+}
+
+const ReverseGeocode &ReverseGeocode::instance()
+{
+  static const ReverseGeocode geocode;
+  return geocode;
+}
 
 ReverseGeocode::ReverseGeocode()
 {
-  pFunc = NULL;
-  PyObject *pName, *pModule;
-  Py_Initialize();
-  pName = PyUnicode_FromString("reverse_geocoder");
-  /* Error checking of pName left out */
-  pModule = PyImport_Import(pName);
-  Py_DECREF(pName);
-  if (pModule != NULL) {
-    pFunc = PyObject_GetAttrString(pModule, "search");
+  static_assert(sizeof(header) == 16 && sizeof(place) == 28, "places layout must match places-pack.py");
+
+  int fd = -1;
+  for (auto file : places_files) {
+    fd = open(file, O_RDONLY);
+    if (fd >= 0) break;
   }
-  else
-  {
-    throw std::runtime_error("module not found");
+  if (fd < 0) throw std::runtime_error("places.bin not found");
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(header)) {
+    close(fd);
+    throw std::runtime_error("Unexpected places format");
+  }
+  m_size = st.st_size;
+  m_data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (m_data == MAP_FAILED) throw std::runtime_error("Cannot map places");
+
+  const header *h = static_cast<const header*>(m_data);
+  m_count = h->place_count;
+  m_text_size = h->text_size;
+  m_places = reinterpret_cast<const place*>(h + 1);
+  m_text = reinterpret_cast<const char*>(m_places + m_count);
+  if (memcmp(h->magic, "TCPL", 4) != 0 || h->version != places_version || m_count == 0 ||
+      sizeof(header) + uint64_t(m_count) * sizeof(place) + m_text_size != m_size ||
+      m_text_size == 0 || m_text[m_text_size - 1] != '\0') {
+    munmap(m_data, m_size);
+    throw std::runtime_error("Unexpected places format");
   }
 }
 
-std::vector<std::map<std::string, std::string>> ReverseGeocode::search(double _lat, double _lon)
+ReverseGeocode::~ReverseGeocode()
 {
-  std::vector<std::map<std::string, std::string>> results;
-  if(pFunc && PyCallable_Check(pFunc))
-  {
-    PyObject *pArgs, *pLat, *pLon, *pList, *pArgs1;
-    pArgs = PyTuple_New(2);
-    pLat = PyFloat_FromDouble(_lat);
-    if(!pLat)
-    {
-      std::cerr << "conversion failed" << std::endl;
-      return results;
-    }
-    
-    PyTuple_SetItem(pArgs, 0, pLat);
-//     Py_DECREF(pLat);
-    pLon = PyFloat_FromDouble(_lon);
-    if(!pLon)
-    {
-      std::cerr << "conversion failed" << std::endl;
-      return results;
-    }
-    PyTuple_SetItem(pArgs, 1, pLon);
-//     Py_DECREF(pLon);
-
-    pArgs1 = PyTuple_New(1);
-    PyTuple_SetItem(pArgs1, 0, pArgs);
-    pList = PyObject_CallObject(pFunc, pArgs1);
-    if(!pList)
-    {
-      std::cout << "invalid args" << std::endl;
-      PyErr_Print();
-      return results;
-    }
-    Py_DECREF(pArgs);
-    Py_DECREF(pLat);
-    Py_DECREF(pLon);
-    Py_DECREF(pArgs1);
-    Py_ssize_t size;
-    size = PyList_Size(pList);
-    for(int i = 0 ; i< size; i++)
-    {
-      std::map<std::string, std::string> result;
-      PyObject *pDict;
-      pDict = PyList_GetItem(pList, i);
-      PyObject *key, *value;
-      Py_ssize_t pos = 0;
-
-      while (PyDict_Next(pDict, &pos, &key, &value)) {
-          const char* s = PyUnicode_AsUTF8(key);
-          const char* s1 = PyUnicode_AsUTF8(value);
-          result[s] = s1;
-      }
-      results.push_back(result);
-      Py_DECREF(pDict);
-      
-    }
-    //Py_DECREF(pList); // why? segfaults on second call, uncommenting pDict unref above also werks
+  munmap(m_data, m_size);
+}
+
+void ReverseGeocode::nearest(const double q[3], uint32_t lo, uint32_t hi, int depth, uint32_t &best, double &best_dist) const
+{
+  if (lo >= hi) return;
+  const uint32_t mid = lo + (hi - lo) / 2;
+  const place &p = m_places[mid];
+  double dist = 0;
+  for (int i = 0; i < 3; ++i) dist += (q[i] - p.xyz[i]) * (q[i] - p.xyz[i]);
+  if (dist < best_dist) {
+    best = mid;
+    best_dist = dist;
   }
-  else
-  {
-    std::cerr << "function not found" << std::endl;
+
+  // Search the side of the split containing q first, and the other side only if it may be nearer
+  const int axis = depth % 3;
+  const double delta = q[axis] - p.xyz[axis];
+  if (delta < 0) {
+    nearest(q, lo, mid, depth + 1, best, best_dist);
+    if (delta * delta < best_dist) nearest(q, mid + 1, hi, depth + 1, best, best_dist);
+  }
+  else {
+    nearest(q, mid + 1, hi, depth + 1, best, best_dist);
+    if (delta * delta < best_dist) nearest(q, lo, mid, depth + 1, best, best_dist);
+  }
+}
+
+std::vector<std::map<std::string, std::string>> ReverseGeocode::search(double _lat, double _lon) const
+{
+  std::vector<std::map<std::string, std::string>> results;
+  if (!std::isfinite(_lat) || !std::isfinite(_lon)) return results;
+
+  double q[3];
+  ecef(_lat, _lon, q);
+  uint32_t best = 0;
+  double best_dist = INFINITY;
+  nearest(q, 0, m_count, 0, best, best_dist);
+
+  const place &p = m_places[best];
+  if (p.text >= m_text_size) throw std::runtime_error("Unexpected places format");
+  std::map<std::string, std::string> result;
+  result["lat"] = std::to_string(p.lat * 1e-7);
+  result["lon"] = std::to_string(p.lon * 1e-7);
+  const char *text = m_text + p.text;
+  const char *end = m_text + m_text_size;
+  for (auto key : { "name", "admin1", "admin2" }) {
+    if (text >= end) throw std::runtime_error("Unexpected places format");
+    result[key] = text;
+    text += strlen(text) + 1; // text is \0 terminated, checked when mapped
   }
+  result["cc"] = std::string(p.cc, strnlen(p.cc, sizeof(p.cc)));
+  results.push_back(result);
   return results;
 }
@@ -1,16 +1,38 @@
-#ifndef REVERSE_GEOCODE_HPP 
+#ifndef REVERSE_GEOCODE_HPP
 #define REVERSE_GEOCODE_HPP
-#include "Python.h"
+#include <cstddef>
+#include <cstdint>
 #include <map>
+#include <string>
 #include <vector>
-#include <iostream>
 
+// Nearest place lookup over the places of the reverse_geocoder package, packed by
+// places-pack.py and memory mapped. One instance is shared by the whole process.
 class ReverseGeocode
 {
 private:
-  PyObject *pFunc;
-public:
+  struct header;
+  struct place;
+
+  void *m_data;
+  size_t m_size;
+  const place *m_places;
+  uint32_t m_count;
+  const char *m_text;
+  uint32_t m_text_size;
+
+  void nearest(const double q[3], uint32_t lo, uint32_t hi, int depth, uint32_t &best, double &best_dist) const;
+
   ReverseGeocode();
-  std::vector<std::map<std::string, std::string>> search(double _lat, double _lon);
+  ~ReverseGeocode();
+
+public:
+  static const ReverseGeocode &instance();
+
+  ReverseGeocode(const ReverseGeocode&) = delete;
+  ReverseGeocode& operator=(const ReverseGeocode&) = delete;
+
+  // Returns the nearest place with the keys lat, lon, name, admin1, admin2 and cc
+  std::vector<std::map<std::string, std::string>> search(double _lat, double _lon) const;
 };
 #endif
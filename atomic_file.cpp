@@ -0,0 +1,51 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "atomic_file.h"
+
+#include <cstdio>
+#include <stdexcept>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+void atomic_write_file(const std::string &path, const std::string &bytes)
+{
+	std::string tmp = path + ".XXXXXX";
+	int fd = mkstemp(&tmp[0]);
+	if (fd == -1) throw std::runtime_error("Could not create " + tmp);
+
+	bool written = true;
+	for (size_t pos = 0; written && pos < bytes.size(); ) {
+		const ssize_t n = write(fd, bytes.data() + pos, bytes.size() - pos);
+		written = n > 0;
+		if (written) pos += n;
+	}
+	// Synced before the rename, so the file is complete after a crash
+	written = written && fsync(fd) == 0;
+	written = close(fd) == 0 && written;
+	if (!written) {
+		unlink(tmp.c_str());
+		throw std::runtime_error("Could not write " + path);
+	}
+	if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+		unlink(tmp.c_str());
+		throw std::runtime_error("Could not save " + path);
+	}
+}
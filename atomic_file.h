@@ -0,0 +1,30 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#ifndef __ATOMIC_FILE_H
+#define __ATOMIC_FILE_H
+
+#include <string>
+
+// Replace the file at path with bytes. Written to a unique temporary file, synced and renamed, so
+// readers and a crash never see a partial file, and concurrent writers don't mix their data.
+// Throws runtime_error if the file can't be written.
+void atomic_write_file(const std::string &path, const std::string &bytes);
+
+#endif
@@ -0,0 +1,39 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "bench.h"
+#include "../ReverseGeocode.hpp"
+
+#include <random>
+
+// Reads places.bin from the build directory, if it is not installed
+int main()
+{
+	// Points all over the world, not just where places are dense
+	std::mt19937 rnd(1);
+	std::uniform_real_distribution<double> lat(-60.0, 70.0), lon(-180.0, 180.0);
+	std::vector<std::pair<double, double>> points;
+	for (int i = 0; i < 10000; ++i) points.emplace_back(lat(rnd), lon(rnd));
+
+	const auto &rg = ReverseGeocode::instance();
+	size_t i = 0;
+	bench("ReverseGeocode::search", 100000, [&]() { auto &p = points[i++ % points.size()]; keep(rg.search(p.first, p.second)); });
+
+	return 0;
+}
@@ -0,0 +1,43 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+// Run f n times and print the mean time per call
+template <class F> void bench(const std::string &name, long n, F f)
+{
+	f(); // warm up, e.g. first use initialization
+	const auto begin = std::chrono::steady_clock::now();
+	for (long i = 0; i < n; ++i) f();
+	const std::chrono::duration<double, std::nano> t = std::chrono::steady_clock::now() - begin;
+	std::cout << name << ": " << t.count() / n << " ns" << std::endl;
+}
+
+// Keep the compiler from optimizing a result away
+template <class T> void keep(const T &v)
+{
+	asm volatile("" : : "g"(&v) : "memory");
+}
+
+#endif
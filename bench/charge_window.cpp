@@ -0,0 +1,82 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "bench.h"
+#include "../charge_window.h"
+
+#include <random>
+#include <iterator>
+#include <limits>
+
+using time_point = std::chrono::time_point<std::chrono::system_clock>;
+
+// The search charge_window_search replaced, which sums every window again. Windows are given as a
+// number of price steps, so it runs on the same 15 minute prices.
+static time_point find_cheapest_start_loop(const price_list &prices, int slots, std::chrono::minutes step, const time_point &start, const time_point &stop)
+{
+	if (slots < 1) return stop;
+	if (prices.size() < 2) return stop - slots * step;
+	auto found_start = stop - slots * step;
+	float found_price_sum = std::numeric_limits<float>::max();
+	for (price_list::const_iterator i_beg = prices.begin(); i_beg != prices.end(); ++i_beg) {
+		if (std::distance(i_beg, prices.end()) < slots) break;
+		if (i_beg->time + slots * step > stop) break;
+		if (i_beg->time + step <= start) continue;
+		float price_sum = 0;
+		for (price_list::const_iterator i_seq = i_beg; i_seq != i_beg + slots; ++i_seq) price_sum += i_seq->price;
+		if (price_sum < found_price_sum) {
+			found_price_sum = price_sum;
+			found_start = i_beg->time;
+		}
+	}
+	return found_start;
+}
+
+int main()
+{
+	std::mt19937 rnd(1);
+	std::uniform_real_distribution<float> price(0.0, 300.0);
+	const std::chrono::time_point<std::chrono::system_clock> start { std::chrono::hours(473000) };
+	const auto stop = start + std::chrono::hours(3 * 24);
+
+	// Three days of 15 minute prices, the longest list tesla_cron plans over
+	price_list prices;
+	for (auto t = start; t < stop; t += std::chrono::minutes(15)) prices.push_back({ t, price(rnd) });
+
+	bench("charge_window_search 288 prices", 100000, [&]() { charge_window_search s(prices); keep(s); });
+
+	charge_window_search cheapest(prices);
+	bench("find 4h", 100000, [&]() { keep(cheapest.find(std::chrono::hours(4), start, stop)); });
+	bench("find_all 6 x 1h", 100000, [&]() { keep(cheapest.find_all(6, std::chrono::hours(1), start, stop)); });
+
+	// A week of 15 minute prices, as with Carnot predictions, against the old loop
+	const auto week_stop = start + std::chrono::hours(7 * 24);
+	price_list week;
+	for (auto t = start; t < week_stop; t += std::chrono::minutes(15)) week.push_back({ t, price(rnd) });
+	const std::chrono::minutes step(15);
+
+	charge_window_search week_search(week);
+	bench("charge_window_search 672 prices", 100000, [&]() { charge_window_search s(week); keep(s); });
+	bench("find 4h, 672 prices", 100000, [&]() { keep(week_search.find(std::chrono::hours(4), start, week_stop)); });
+	bench("old loop 4h, 672 prices", 10000, [&]() { keep(find_cheapest_start_loop(week, 16, step, start, week_stop)); });
+	bench("find_all 6 x 1h, 672 prices", 100000, [&]() { keep(week_search.find_all(6, std::chrono::hours(1), start, week_stop)); });
+	bench("old loop 1h to 6h, 672 prices", 1000, [&]() { for (int h = 1; h <= 6; ++h) keep(find_cheapest_start_loop(week, h * 4, step, start, week_stop)); });
+
+	return 0;
+}
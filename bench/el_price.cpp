@@ -0,0 +1,110 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "bench.h"
+#include "../el_price.h"
+
+#include <date/tz.h>
+
+#include <random>
+#include <algorithm>
+#include <sstream>
+
+// The join add_tarif_prices replaced: a search of the whole tarif list and an erase per hourly price
+static void add_tarif_prices_find(price_list &prices, price_list &tarif)
+{
+	for (auto& p : prices) {
+		auto i_t = std::find(tarif.begin(), tarif.end(), p);
+		if (i_t == tarif.end()) {
+			std::cout << "Error: No tarif price found for " << p.time.time_since_epoch().count() << std::endl;
+			continue;
+		}
+		p.price += i_t->price;
+		tarif.erase(i_t);
+	}
+}
+
+int main()
+{
+	std::mt19937 rnd(1);
+	std::uniform_real_distribution<float> price(0.0, 300.0);
+	const std::chrono::time_point<std::chrono::system_clock> start { std::chrono::hours(473000) };
+
+	// Three days of 15 minute spot prices and the hourly tarifs for them
+	price_list spot, tarif;
+	for (int i = 0; i < 3 * 24 * 4; ++i) spot.push_back({ start + i * std::chrono::minutes(15), price(rnd) });
+	for (int i = 0; i < 3 * 24; ++i) tarif.push_back({ start + i * std::chrono::hours(1), price(rnd) });
+
+	price_list prices;
+	bench("add_tarif_prices 288 prices", 100000, [&]() { prices = spot; add_tarif_prices(prices, tarif); keep(prices); });
+
+	// A week of hourly prices in the middle of about 15 months of hourly tarifs. The old join
+	// needs hourly prices. Both copy the lists first, as the old one uses up the tarif list.
+	price_list long_tarif, week;
+	for (int i = 0; i < 10000; ++i) long_tarif.push_back({ start + i * std::chrono::hours(1), price(rnd) });
+	for (int i = 0; i < 7 * 24; ++i) week.push_back({ start + (5000 + i) * std::chrono::hours(1), price(rnd) });
+
+	price_list tarif_copy;
+	bench("add_tarif_prices 168 prices, 10k tarifs", 10000, [&]() { prices = week; tarif_copy = long_tarif; add_tarif_prices(prices, tarif_copy); keep(prices); });
+	bench("find/erase join 168 prices, 10k tarifs", 1000, [&]() { prices = week; tarif_copy = long_tarif; add_tarif_prices_find(prices, tarif_copy); keep(prices); });
+
+	std::chrono::time_point<std::chrono::system_clock> time;
+	const std::string time_str = "2025-10-01T13:45:00";
+	bench("parse_iso_time", 1000000, [&]() { keep(parse_iso_time(time_str, time)); keep(time); });
+
+	std::uniform_int_distribution<int32_t> day(18000, 22000);
+	bench("cet_day_start", 1000000, [&]() { keep(cet_day_start(day(rnd))); });
+
+	// A year of 15 minute price timestamps and of tarif days, against the stringstream, date::parse and
+	// date::make_zoned code they replaced. Both must give the same times, also on the DST changes.
+	std::vector<std::string> year_times;
+	for (int i = 0; i < 365 * 24 * 4; ++i) year_times.push_back(date::format("%Y-%m-%dT%H:%M:%S", date::floor<std::chrono::seconds>(start + i * std::chrono::minutes(15))));
+	const int32_t first_day = date::floor<date::days>(start).time_since_epoch().count();
+	const auto zone = date::locate_zone("CET");
+
+	auto parse_stream = [](const std::string &str, std::chrono::time_point<std::chrono::system_clock> &time) {
+		std::stringstream ss(str);
+		ss >> date::parse("%Y-%m-%dT%H:%M:%S", time);
+	};
+	auto day_start_zoned = [zone](int32_t day) {
+		return date::make_zoned(zone, date::local_days(date::days(day))).get_sys_time();
+	};
+
+	for (auto &str : year_times) {
+		std::chrono::time_point<std::chrono::system_clock> fast, old;
+		parse_stream(str, old);
+		if (!parse_iso_time(str, fast) || fast != old) {
+			std::cerr << "Error: parse_iso_time differs from date::parse for " << str << std::endl;
+			return 1;
+		}
+	}
+	for (int32_t d = first_day; d < first_day + 365; ++d) {
+		if (cet_day_start(d) != day_start_zoned(d)) {
+			std::cerr << "Error: cet_day_start differs from date::make_zoned for day " << d << std::endl;
+			return 1;
+		}
+	}
+
+	bench("parse_iso_time year of 15 minute times", 10, [&]() { for (auto &str : year_times) { keep(parse_iso_time(str, time)); keep(time); } });
+	bench("date::parse year of 15 minute times", 10, [&]() { for (auto &str : year_times) { parse_stream(str, time); keep(time); } });
+	bench("cet_day_start year of days", 1000, [&]() { for (int32_t d = first_day; d < first_day + 365; ++d) keep(cet_day_start(d)); });
+	bench("date::make_zoned year of days", 100, [&]() { for (int32_t d = first_day; d < first_day + 365; ++d) keep(day_start_zoned(d)); });
+
+	return 0;
+}
@@ -0,0 +1,71 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "bench.h"
+#include "../location.h"
+
+#include <random>
+
+int main()
+{
+	// Points spread over Denmark, so most lookups hit a boundary and some fall in the sea
+	std::mt19937 rnd(1);
+	std::uniform_real_distribution<double> lat(54.5, 57.8), lon(8.0, 12.7);
+	std::vector<location> points;
+	for (int i = 0; i < 10000; ++i) points.emplace_back(lat(rnd), lon(rnd));
+
+	// The scalar kernel one point at a time is the reference for the vectorized kernels and the batch lookup
+	std::vector<location> check;
+	for (int i = 0; i < 200000; ++i) check.emplace_back(lat(rnd), lon(rnd));
+	for (int i = 0; i < 1000; ++i) check.push_back(check[i]); // Equal points, as when parked
+	check.emplace_back(0.0, 0.0);
+	check.emplace_back();
+	set_elnet_kernel(elnet_kernel::scalar);
+	std::vector<std::string> expected;
+	for (auto &p : check) expected.push_back(get_elnet(p));
+
+	const std::pair<elnet_kernel, std::string> kernels[] = { { elnet_kernel::scalar, "scalar" }, { elnet_kernel::sse2, "sse2" }, { elnet_kernel::avx, "avx" } };
+	for (auto &k : kernels) {
+		if (!set_elnet_kernel(k.first)) {
+			std::cout << k.second << ": not supported" << std::endl;
+			continue;
+		}
+		const auto batch = get_elnet(check);
+		for (size_t i = 0; i < check.size(); ++i) {
+			if (get_elnet(check[i]) != expected[i] || batch[i] != expected[i]) {
+				std::cerr << "Error: " << k.second << " elnet of (" << check[i].lat() << ", " << check[i].lon() << ") differs from scalar" << std::endl;
+				return 1;
+			}
+		}
+
+		size_t i = 0;
+		bench(k.second + " get_elnet", 100000, [&]() { keep(get_elnet(points[i++ % points.size()])); });
+		bench(k.second + " get_elnet 10000 points one at a time", 10, [&]() { for (auto &p : points) keep(get_elnet(p)); });
+	}
+
+	// The batch lookup tests edges against points without the kernels
+	bench("get_elnet 10000 points", 10, [&]() { keep(get_elnet(points)); });
+
+	// Drive history, where the car is mostly parked at a few places
+	std::vector<location> parked;
+	for (int i = 0; i < 10000; ++i) parked.push_back(points[i % 100]);
+	bench("get_elnet 10000 points at 100 places", 10, [&]() { keep(get_elnet(parked)); });
+
+	return 0;
+}
@@ -0,0 +1,188 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+
+#include "calendar.h"
+#include "ics.h"
+#include "http.h"
+#include "retry.h"
+#include "atomic_file.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <list>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+const std::string index_path = "/var/tmp/tesla-cron";
+
+const char index_magic[4] = { 'T', 'C', 'C', 'A' };
+const uint32_t index_version = 2;
+
+// An index is built for this long ahead, so it is only rebuilt when the calendar changes
+constexpr std::chrono::hours index_horizon { 14 * 24 };
+
+struct index_header
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t url_size;
+	uint32_t etag_size;
+	uint32_t last_modified_size;
+	uint32_t count;
+	uint64_t hash;
+	int64_t from;
+	int64_t to;
+};
+
+// FNV-1a. Stable between builds, unlike std::hash, so it can be stored.
+uint64_t fnv1a(const std::string &s)
+{
+	uint64_t h = 14695981039346656037ull;
+	for (unsigned char c : s) {
+		h ^= c;
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+int64_t to_seconds(std::chrono::system_clock::time_point t)
+{
+	return std::chrono::duration_cast<std::chrono::seconds>(t.time_since_epoch()).count();
+}
+
+}
+
+calendar_index::calendar_index(const std::string &url) : m_url(url)
+{
+	std::stringstream name;
+	name << index_path << "/calendar-" << std::hex << std::setw(16) << std::setfill('0') << fnv1a(url) << ".bin";
+	m_file = name.str();
+}
+
+bool calendar_index::sync(time_point from, time_point to)
+{
+	const bool covered = load() && m_from <= to_seconds(from) && to_seconds(to) <= m_to;
+
+	// Without a usable index the calendar is needed even if it did not change
+	std::list<std::string> headers;
+	if (covered) {
+		if (!m_etag.empty()) headers.push_back("If-None-Match: " + m_etag);
+		if (!m_last_modified.empty()) headers.push_back("If-Modified-Since: " + m_last_modified);
+	}
+
+	auto response = retry(retry_policy(), [&]() {
+		return http_session::instance().get(m_url, headers);
+	});
+	if (response.status == 304) return false;
+
+	// Servers without ETag and Last-Modified often generate the calendar for each request, eg with a
+	// new DTSTAMP. So the hash only saves parsing an unchanged calendar, and a change is a change of the
+	// charge events.
+	const uint64_t hash = fnv1a(response.body);
+	bool changed = false;
+	if (hash != m_hash || !covered) {
+		const auto before = events(from, to);
+		build(response.body, from, std::max(to, from + index_horizon));
+		changed = events(from, to) != before;
+	}
+	m_hash = hash;
+	m_etag = response.etag;
+	m_last_modified = response.last_modified;
+	save();
+	return changed;
+}
+
+calendar_index::time_point calendar_index::next_event(time_point from, time_point to) const
+{
+	auto e = events(from, to);
+	return e.empty() ? to : e.front();
+}
+
+std::vector<calendar_index::time_point> calendar_index::events(time_point from, time_point to) const
+{
+	std::vector<time_point> ret;
+	auto i = std::lower_bound(m_events.begin(), m_events.end(), from, [](int64_t e, time_point t) { return time_point(std::chrono::seconds(e)) < t; });
+	for (; i != m_events.end() && time_point(std::chrono::seconds(*i)) <= to; ++i) ret.push_back(time_point(std::chrono::seconds(*i)));
+	return ret;
+}
+
+void calendar_index::build(const std::string &cal, time_point from, time_point to)
+{
+	m_events.clear();
+	for (auto &e : ics_event_starts(cal, "[T]", from, to)) m_events.push_back(to_seconds(e));
+	m_from = to_seconds(from);
+	m_to = to_seconds(to);
+}
+
+// A missing or invalid file, or one for another url, loads as an empty index
+bool calendar_index::load()
+{
+	m_etag.clear();
+	m_last_modified.clear();
+	m_hash = 0;
+	m_from = m_to = 0;
+	m_events.clear();
+
+	std::ifstream is(m_file, std::ios::binary);
+	if (!is) return false;
+
+	index_header h;
+	if (!is.read(reinterpret_cast<char*>(&h), sizeof(h))) return false;
+	if (memcmp(h.magic, index_magic, sizeof(index_magic)) != 0 || h.version != index_version) return false;
+
+	std::string url(h.url_size, '\0'), etag(h.etag_size, '\0'), last_modified(h.last_modified_size, '\0');
+	std::vector<int64_t> events(h.count);
+	if (!is.read(&url[0], url.size()) || url != m_url) return false;
+	if (!is.read(&etag[0], etag.size()) || !is.read(&last_modified[0], last_modified.size())) return false;
+	if (!is.read(reinterpret_cast<char*>(events.data()), events.size() * sizeof(int64_t))) return false;
+
+	m_etag = std::move(etag);
+	m_last_modified = std::move(last_modified);
+	m_hash = h.hash;
+	m_from = h.from;
+	m_to = h.to;
+	m_events = std::move(events);
+	return true;
+}
+
+void calendar_index::save() const
+{
+	index_header h {};
+	memcpy(h.magic, index_magic, sizeof(index_magic));
+	h.version = index_version;
+	h.url_size = m_url.size();
+	h.etag_size = m_etag.size();
+	h.last_modified_size = m_last_modified.size();
+	h.count = m_events.size();
+	h.hash = m_hash;
+	h.from = m_from;
+	h.to = m_to;
+
+	std::string bytes(reinterpret_cast<const char*>(&h), sizeof(h));
+	bytes += m_url;
+	bytes += m_etag;
+	bytes += m_last_modified;
+	bytes.append(reinterpret_cast<const char*>(m_events.data()), m_events.size() * sizeof(int64_t));
+	atomic_write_file(m_file, bytes);
+}
@@ -0,0 +1,65 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+
+#ifndef __CALENDAR_H
+#define __CALENDAR_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Start times of the charge events of a calendar (events with "[T]" in the summary), with
+// recurrences expanded. The index is kept per url in /var/tmp/tesla-cron together with the
+// ETag or Last-Modified of the download, so an unchanged calendar is not parsed again.
+class calendar_index
+{
+	public:
+	typedef std::chrono::system_clock::time_point time_point;
+
+	explicit calendar_index(const std::string &url);
+
+	// Conditional download of the calendar. The index is rebuilt when the calendar changed or
+	// the index does not cover from-to. Returns true if the charge events in from-to changed
+	// since the last sync.
+	bool sync(time_point from, time_point to);
+
+	// First event in from-to (both included), or to if there is none
+	time_point next_event(time_point from, time_point to) const;
+
+	// Events in from-to (both included)
+	std::vector<time_point> events(time_point from, time_point to) const;
+
+	protected:
+	bool load();
+	void save() const;
+	void build(const std::string &cal, time_point from, time_point to);
+
+	std::string m_url;
+	std::string m_file;
+	std::string m_etag;
+	std::string m_last_modified;
+	uint64_t m_hash { 0 };             // Hash of the calendar, for servers without ETag and Last-Modified
+	int64_t m_from { 0 };              // Time covered by the index. Seconds since epoch
+	int64_t m_to { 0 };
+	std::vector<int64_t> m_events;     // Sorted. Seconds since epoch
+};
+
+#endif
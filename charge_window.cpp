@@ -0,0 +1,85 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+ 
+#include "charge_window.h"
+
+#include <algorithm>
+#include <limits>
+
+charge_window_search::charge_window_search(const price_list &prices) : m_prices(prices), m_step(price_step(prices))
+{
+	m_sum.reserve(prices.size() + 1);
+	m_sum.push_back(0);
+	for (auto &p : prices) m_sum.push_back(m_sum.back() + p.price);
+}
+
+// Index of the first price which ends after start
+size_t charge_window_search::first_index(const time_point &start) const
+{
+	auto i = std::partition_point(m_prices.begin(), m_prices.end(),
+			[this, &start](const price_entry &p) { return p.time + m_step <= start; });
+	return i - m_prices.begin();
+}
+
+charge_window_search::time_point charge_window_search::find(std::chrono::minutes length, const time_point &start, const time_point &stop) const
+{
+	if (length.count() <= 0) return stop; // return stop on 0 length - no need to charge
+	if (m_prices.size() < 2) return stop - length; // nothing to compare with < two prices
+	auto found_start = stop - length; // keep window before stop if no seq is found (stop - start < length)
+	const size_t n = slots(length);
+	double found_price_sum = std::numeric_limits<double>::max();
+	for (size_t i = first_index(start); i + n <= m_prices.size(); ++i) {
+		if (m_prices[i].time + length > stop) break; // stop if seq ends after stop
+		double price_sum = window_sum(i, n);
+		if (price_sum < found_price_sum) {
+			found_price_sum = price_sum;
+			found_start = m_prices[i].time;
+		}
+	}
+	return found_start;
+}
+
+std::vector<charge_window_search::time_point> charge_window_search::find_all(int count, std::chrono::minutes length, const time_point &start, const time_point &stop) const
+{
+	std::vector<time_point> found_start;
+	std::vector<size_t> n;
+	for (int w = 1; w <= count; ++w) {
+		found_start.push_back(stop - w * length);
+		n.push_back(slots(w * length));
+	}
+	if (m_prices.size() < 2) return found_start; // nothing to compare with < two prices
+
+	std::vector<double> found_price_sum(count, std::numeric_limits<double>::max());
+	for (size_t i = first_index(start); i < m_prices.size(); ++i) {
+		int w = 0;
+		for (; w < count; ++w) {
+			// Longer windows will also be out of known prices or end after stop
+			if (i + n[w] > m_prices.size()) break;
+			if (m_prices[i].time + (w + 1) * length > stop) break;
+			double price_sum = window_sum(i, n[w]);
+			if (price_sum < found_price_sum[w]) {
+				found_price_sum[w] = price_sum;
+				found_start[w] = m_prices[i].time;
+			}
+		}
+		if (w == 0) break; // Even the shortest window ends after stop. So will all later windows.
+	}
+	return found_start;
+}
+
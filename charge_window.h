@@ -0,0 +1,59 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#ifndef __CHARGE_WINDOW_H
+#define __CHARGE_WINDOW_H
+
+#include "el_price.h"
+
+#include <vector>
+#include <chrono>
+
+// Search for the cheapest charge window in a price list. Prefix sums of the prices are
+// built once, so the price of any window is a single subtraction. Windows can have any
+// length and are rounded up to whole price steps.
+class charge_window_search
+{
+	public:
+	using time_point = std::chrono::time_point<std::chrono::system_clock>;
+
+	explicit charge_window_search(const price_list &prices);
+
+	// Start of the cheapest window of 'length' which ends after 'start' and before 'stop'.
+	// Returns stop - length if no such window is known.
+	time_point find(std::chrono::minutes length, const time_point &start, const time_point &stop) const;
+
+	// Same as find() for windows of 1 to count times 'length', in one pass over the prices.
+	// Element i is the start of the cheapest window of (i+1) * length.
+	std::vector<time_point> find_all(int count, std::chrono::minutes length, const time_point &start, const time_point &stop) const;
+
+	std::chrono::minutes step() const { return m_step; }
+
+	protected:
+	const price_list &m_prices;
+	std::chrono::minutes m_step;
+	std::vector<double> m_sum; // m_sum[i] is the sum of the first i prices
+
+	size_t first_index(const time_point &start) const;
+	size_t slots(std::chrono::minutes length) const { return (length + m_step - std::chrono::minutes(1)) / m_step; }
+	double window_sum(size_t i, size_t slots) const { return m_sum[i + slots] - m_sum[i]; }
+};
+
+#endif
+
@@ -0,0 +1,141 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+ 
+#include "el_price.h"
+#include "log.h"
+#include "record_store_impl.h"
+
+#include <date/tz.h>
+
+#include <algorithm>
+#include <iterator>
+#include <iostream>
+
+std::chrono::minutes price_step(const price_list &prices)
+{
+	std::chrono::minutes step { 0 };
+	for (size_t i = 1; i < prices.size(); ++i) {
+		auto d = std::chrono::duration_cast<std::chrono::minutes>(prices[i].time - prices[i - 1].time);
+		if (d.count() > 0 && (step.count() == 0 || d < step)) step = d;
+	}
+	return step.count() > 0 ? step : std::chrono::hours(1);
+}
+
+price_list resample(const price_list &prices, std::chrono::minutes step)
+{
+	price_list ret;
+	ret.reserve(prices.size());
+	for (size_t i = 0; i < prices.size(); ++i) {
+		// The last price is as long as the one before
+		auto length = i + 1 < prices.size() ? prices[i + 1].time - prices[i].time
+			: i > 0 ? prices[i].time - prices[i - 1].time
+			: std::chrono::hours(1);
+		const auto end = prices[i].time + std::min<std::chrono::system_clock::duration>(length, std::chrono::hours(1));
+		for (auto entry = prices[i]; entry.time < end; entry.time += step) ret.push_back(entry);
+	}
+	return ret;
+}
+
+void add_tarif_prices(price_list &prices, const price_list &tarif)
+{
+	auto i_t = tarif.begin();
+	for (auto& p : prices) {
+		while (i_t != tarif.end() && i_t->time + std::chrono::hours(1) <= p.time) ++i_t;
+		if (i_t == tarif.end() || p.time < i_t->time) {
+			log_line() << "Error: No tarif price found for " << date::make_zoned(date::current_zone(), p.time);
+			continue;
+		}
+		p.price += i_t->price;
+	}
+}
+
+
+namespace {
+	// Value of the digits str[pos, pos+n), or -1 if one is not a digit
+	int digits(const std::string &str, size_t pos, size_t n)
+	{
+		int v = 0;
+		for (size_t i = pos; i < pos + n; ++i) {
+			const char c = str[i];
+			if (c < '0' || c > '9') return -1;
+			v = v * 10 + (c - '0');
+		}
+		return v;
+	}
+
+	// Offset from UTC starting at each CET transition. Built once from the time zone database.
+	struct cet_transition
+	{
+		date::sys_seconds begin;
+		std::chrono::seconds offset;
+	};
+
+	const std::vector<cet_transition> &cet_transitions()
+	{
+		static const std::vector<cet_transition> transitions = []() {
+			std::vector<cet_transition> ret;
+			const auto zone = date::locate_zone("CET");
+			const date::sys_seconds end = date::sys_days(date::year(2200)/1/1);
+			date::sys_seconds t = date::sys_days(date::year(1970)/1/1);
+			while (t < end) {
+				const auto info = zone->get_info(t);
+				ret.push_back({ t, info.offset });
+				if (info.end <= t) break;
+				t = info.end;
+			}
+			return ret;
+		}();
+		return transitions;
+	}
+}
+
+bool parse_iso_day(const std::string &str, int32_t &day)
+{
+	if (str.size() < 10 || str[4] != '-' || str[7] != '-') return false;
+	const int y = digits(str, 0, 4), m = digits(str, 5, 2), d = digits(str, 8, 2);
+	if (y < 0 || m < 0 || d < 0) return false;
+	const date::year_month_day ymd { date::year(y), date::month(m), date::day(d) };
+	if (!ymd.ok()) return false;
+	day = date::sys_days(ymd).time_since_epoch().count();
+	return true;
+}
+
+bool parse_iso_time(const std::string &str, std::chrono::time_point<std::chrono::system_clock> &time)
+{
+	int32_t day;
+	if (str.size() < 19 || !parse_iso_day(str, day) || str[10] != 'T' || str[13] != ':' || str[16] != ':') return false;
+	const int h = digits(str, 11, 2), m = digits(str, 14, 2), s = digits(str, 17, 2);
+	if (h < 0 || h > 23 || m < 0 || m > 59 || s < 0 || s > 60) return false;
+	time = date::sys_days(date::days(day)) + std::chrono::hours(h) + std::chrono::minutes(m) + std::chrono::seconds(s);
+	return true;
+}
+
+std::chrono::time_point<std::chrono::system_clock> cet_day_start(int32_t day)
+{
+	// CET changes offset at 01:00 UTC, never in the hours before local midnight. So the offset
+	// in effect an hour before midnight UTC is the offset at local midnight.
+	const auto &transitions = cet_transitions();
+	const date::sys_seconds midnight = date::sys_days(date::days(day));
+	auto i = std::upper_bound(transitions.begin(), transitions.end(), midnight - std::chrono::hours(1), [](const date::sys_seconds &t, const cet_transition &tr) { return t < tr.begin; });
+	const std::chrono::seconds offset = i == transitions.begin() ? std::chrono::hours(1) : std::prev(i)->offset;
+	return midnight - offset;
+}
+
+template class record_store<price_entry>;
+template class record_store<tarif_record>;
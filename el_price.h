@@ -24,6 +24,9 @@
 #include <map>
 #include <chrono>
 #include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
 
 struct price_entry
 {
@@ -36,6 +39,42 @@ struct price_entry
 
 typedef std::vector<price_entry> price_list;
 
+// Time between prices in a list. Day ahead prices may be hourly or 15 minutes.
+// This is the smallest spacing found, 1h if the list has less than two prices.
+std::chrono::minutes price_step(const price_list &prices);
+
+// Split each price into prices of step length. Eg to merge hourly prices into a 15 minute list.
+// A price lasts until the next one, at most 1h, so a list mixing hourly and 15 minute prices
+// gets the single step too.
+price_list resample(const price_list &prices, std::chrono::minutes step);
+
+// Add the hourly tarif to each price. Both lists are sorted by time, so they are joined in one pass.
+// With a finer price step, all prices within the hour get the hour's tarif.
+void add_tarif_prices(price_list &prices, const price_list &tarif);
+
+// One tarif price list. 24 hourly prices valid for a range of days.
+// Days are counted from epoch in CET local time as the tarifs follow the danish day.
+struct tarif_record
+{
+	static constexpr int32_t open_end = std::numeric_limits<int32_t>::max();
+
+	int32_t valid_from;   // First valid day
+	int32_t valid_to;     // First day not valid. open_end if not known yet
+	float price[24];      // dkk/kwh
+};
+
+typedef std::vector<tarif_record> tarif_list;
+
+// Parse the fixed width UTC time "YYYY-MM-DDTHH:MM:SS" used by the price services. Anything after
+// the seconds is ignored. Returns false if str does not start with a valid time.
+bool parse_iso_time(const std::string &str, std::chrono::time_point<std::chrono::system_clock> &time);
+
+// Parse the date "YYYY-MM-DD" at the start of str as days from epoch.
+bool parse_iso_day(const std::string &str, int32_t &day);
+
+// Start of a CET day (local midnight, with DST) as system time. Days are counted as in tarif_record.
+std::chrono::time_point<std::chrono::system_clock> cet_day_start(int32_t day);
+
 #endif
 
 
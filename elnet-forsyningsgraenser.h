@@ -1,6 +1,7 @@
-extern unsigned char elnet_forsyningsgraenser_022020_json[];
-extern unsigned int elnet_forsyningsgraenser_022020_json_len;
 
-inline const char* elnet_json() { return reinterpret_cast<const char*>(elnet_forsyningsgraenser_022020_json); }
-inline int elnet_json_len() { return elnet_forsyningsgraenser_022020_json_len; }
+extern unsigned char elnet_forsyningsgraenser_022020_bin[];
+extern unsigned int elnet_forsyningsgraenser_022020_bin_len;
+
+inline const void* elnet_bin() { return elnet_forsyningsgraenser_022020_bin; }
+inline size_t elnet_bin_len() { return elnet_forsyningsgraenser_022020_bin_len; }
 
@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+#*************************************************************************
+#** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+#**
+#** This file is part of tesla-cron.
+#**
+#** tesla-cron is free software: you can redistribute it and/or modify
+#** it under the terms of the GNU General Public License as published by
+#** the Free Software Foundation, either version 3 of the License, or
+#** (at your option) any later version.
+#**
+#** tesla-cron is distributed in the hope that it will be useful,
+#** but WITHOUT ANY WARRANTY; without even the implied warranty of
+#** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+#** GNU General Public License for more details.
+#**
+#** You should have received a copy of the GNU General Public License
+#** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+#*************************************************************************/
+
+# Packs elnet boundaries from GeoJSON into the binary layout read by location.cpp.
+# usage: elnet-pack.py <in.json> <out.bin>
+#
+# All values are little endian. Coordinates are int32 in 1e-7 degrees.
+#
+#  header   magic "TCEN", version, feature_count, ring_count, coord_count,
+#           grid_size, cell_feature_count, names_size, bbox
+#  feature  bbox, first_ring, ring_count, name_offset, name_size, multi, reserved
+#  ring     bbox, first coord, coord count, part, reserved
+#  lat      int32[coord_count]
+#  lon      int32[coord_count]
+#  cells    uint32[grid_size*grid_size+1], index of first feature of each cell
+#  features uint32[cell_feature_count], features of the cells in file order
+#  names    utf-8, not terminated
+#
+# A bbox is int32 lat_min, lat_max, lon_min, lon_max.
+
+import json
+import struct
+import sys
+
+version = 1
+grid_size = 64
+scale = 10000000
+name_max = 47  # bytes. Must match elnet_name_max in place.h, which caches the names
+
+def fixed(deg):
+    return int(round(deg * scale))
+
+def bbox_add(box, lat, lon):
+    if box is None:
+        return [lat, lat, lon, lon]
+    return [min(box[0], lat), max(box[1], lat), min(box[2], lon), max(box[3], lon)]
+
+def bbox_merge(box, other):
+    box = bbox_add(box, other[0], other[2])
+    return bbox_add(box, other[1], other[3])
+
+def cell(v, lo, hi):
+    # Must match elnet_map::cell in location.cpp
+    return min(grid_size - 1, max(0, (v - lo) * grid_size // (hi - lo)))
+
+def main(src, dst):
+    with open(src, encoding='utf-8') as f:
+        doc = json.load(f)
+
+    features = []
+    rings = []
+    lat = []
+    lon = []
+    names = b''
+    total = None
+
+    for f in doc['features']:
+        name = f['properties']['Selsk_Nvn'].encode('utf-8')
+        if len(name) > name_max:
+            raise ValueError('Elnet name longer than %d bytes: %s' % (name_max, name.decode('utf-8')))
+        geometry = f['geometry']
+        if geometry['type'] == 'Polygon':
+            multi = 0
+            parts = [geometry['coordinates']]
+        elif geometry['type'] == 'MultiPolygon':
+            multi = 1
+            parts = geometry['coordinates']
+        else:
+            raise ValueError('Unexpected elnet geometry ' + geometry['type'])
+
+        first_ring = len(rings)
+        box = None
+        for part, polygon in enumerate(parts):
+            for ring in polygon:
+                if not ring:
+                    continue
+                first = len(lat)
+                ring_box = None
+                for c in ring:
+                    lat.append(fixed(c[1]))
+                    lon.append(fixed(c[0]))
+                    ring_box = bbox_add(ring_box, lat[-1], lon[-1])
+                rings.append((ring_box, first, len(lat) - first, part))
+                box = bbox_merge(box, ring_box)
+        if box is None:
+            continue
+        features.append((box, first_ring, len(rings) - first_ring, len(names), len(name), multi))
+        names += name
+        total = bbox_merge(total, box)
+
+    cells = [[] for _ in range(grid_size * grid_size)]
+    for i, f in enumerate(features):
+        box = f[0]
+        for y in range(cell(box[0], total[0], total[1]), cell(box[1], total[0], total[1]) + 1):
+            for x in range(cell(box[2], total[2], total[3]), cell(box[3], total[2], total[3]) + 1):
+                cells[y * grid_size + x].append(i)
+    cell_first = []
+    cell_features = []
+    for c in cells:
+        cell_first.append(len(cell_features))
+        cell_features += c
+    cell_first.append(len(cell_features))
+
+    out = bytearray()
+    out += b'TCEN'
+    out += struct.pack('<7I4i', version, len(features), len(rings), len(lat),
+                       grid_size, len(cell_features), len(names), *total)
+    for box, first_ring, ring_count, name_offset, name_size, multi in features:
+        out += struct.pack('<4i6I', *box, first_ring, ring_count, name_offset, name_size, multi, 0)
+    for box, first, count, part in rings:
+        out += struct.pack('<4i4I', *box, first, count, part, 0)
+    out += struct.pack('<%di' % len(lat), *lat)
+    out += struct.pack('<%di' % len(lon), *lon)
+    out += struct.pack('<%dI' % len(cell_first), *cell_first)
+    out += struct.pack('<%dI' % len(cell_features), *cell_features)
+    out += names
+
+    with open(dst, 'wb') as f:
+        f.write(out)
+
+if __name__ == '__main__':
+    if len(sys.argv) != 3:
+        sys.exit('usage: elnet-pack.py <in.json> <out.bin>')
+    main(sys.argv[1], sys.argv[2])
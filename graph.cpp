@@ -18,12 +18,16 @@
  *************************************************************************/
  
 #include "graph.h"
+#include "log.h"
 
 #include <rrd.h>
 #include <sstream>
 #include <fstream>
 #include <iostream>
 #include <ctime>
+#include <mutex>
+#include <vector>
+#include <algorithm>
 
 bool file_exists(const std::string& name) 
 {
@@ -31,8 +35,12 @@ bool file_exists(const std::string& name)
 	return f.good();
 }
 
-void graph(const std::string &vin, const price_entry &price, int window_level, date::sys_time<std::chrono::system_clock::duration> next_event, const vehicle_data &vd)
+void graph(const std::string &vin, price_list::const_iterator price, price_list::const_iterator prices_end, std::chrono::minutes price_step, date::sys_time<std::chrono::system_clock::duration> run_end, int window_level, date::sys_time<std::chrono::system_clock::duration> next_event, const vehicle_data &vd)
 {
+	// rrd_update is not thread safe
+	static std::mutex rrd_mutex;
+	std::lock_guard<std::mutex> lock(rrd_mutex);
+
         const bool vd_ok = vin == vd.vin;
 
 	std::string rrd_path = "/var/tmp";
@@ -53,40 +61,53 @@ void graph(const std::string &vin, const price_entry &price, int window_level, d
 
         char charging = vd_ok ? vd.charge_state.charging_state == "Charging" ? '1' : '0' : 'U';
 
-	auto hour_end = price.time + std::chrono::minutes(60); // current price last until next hour
-
-	// if next event is within 30 min in next hour, extend this hour to that. Otherwise it could be 
-	// ignored by next invoke if eg next event is 7:05 and now is 7:10
-	if ((next_event > hour_end) && (next_event < hour_end + std::chrono::minutes(30))) {
-		hour_end = next_event;
+	// if next event is within 30 min after this run, extend this run to that. Otherwise it could be
+	// ignored by next invoke if eg next event is 7:05 and next run is 7:10
+	if ((next_event > run_end) && (next_event < run_end + std::chrono::minutes(30))) {
+		run_end = next_event;
 	}
 
-	// do 1 - 3 graphs. 0=event start (if in this hour), 1=event end (if in this hour), 2=hour end
-	std::vector<date::sys_time<std::chrono::system_clock::duration>> graph_times;
-	if (next_event <= hour_end) {
-		graph_times.push_back(next_event - std::chrono::minutes(1)); // event start.
-		graph_times.push_back(next_event);                           // event end
+	// One point at the end of each price step until the next run, as each price lasts until the next one.
+	// Around the event two more: 1 minute before it with event 0, and at it with event 1.
+	struct point
+	{
+		date::sys_time<std::chrono::system_clock::duration> time;
+		float price;
+		int window_level;
+		bool event;
+	};
+	std::vector<point> points;
+	bool event_pending = true;
+	for (; price != prices_end && price->time < run_end; ++price) {
+		const auto step_end = std::min<date::sys_time<std::chrono::system_clock::duration>>(price->time + price_step, run_end);
+		if (event_pending && next_event <= step_end) {
+			points.push_back({ next_event - std::chrono::minutes(1), price->price, window_level, false }); // event start
+			points.push_back({ next_event, price->price, window_level, true });                           // event end
+			window_level = 0; // stop window at event instead of run end
+			event_pending = false;
+		}
+		points.push_back({ step_end, price->price, window_level, false });
 	}
-        graph_times.push_back(hour_end);
 
-	bool event_on = false;
-	for (auto t : graph_times) {
-		auto time_sec = std::chrono::duration_cast<std::chrono::seconds>(t.time_since_epoch()).count();
+	// Times must increase. An earlier run may already have written past now, eg in daemon mode when
+	// prices change before the planned run.
+	auto last = std::chrono::system_clock::from_time_t(rrd_last_r(rrd_name.c_str()));
+	for (auto &p : points) {
+		if (p.time <= last) continue;
+		last = p.time;
+		auto time_sec = std::chrono::duration_cast<std::chrono::seconds>(p.time.time_since_epoch()).count();
 		std::stringstream values;
-		values << time_sec << ":" << price.price;
+		values << time_sec << ":" << p.price;
 		if (vd_ok) values << ":" << vd.charge_state.battery_level; else values << ":" << 'U';
-		values << ":" << window_level;
+		values << ":" << p.window_level;
 		values << ":" << charging;
-		values << ":" << (event_on ? 1 : 0); // event 0 on first, 1 on second 
+		values << ":" << (p.event ? 1 : 0);
 		std::string values_str = values.str();
 		const char *updateparams[] = { "rrdupdate", rrd_name.c_str(), values_str.c_str() };
 		const int param_count = sizeof(updateparams) / sizeof(updateparams[0]);
 		int res = rrd_update(param_count, (char**)updateparams);
-		if(res !=0) std::cerr << "graph err: " << rrd_get_error() << std::endl;
+		if(res !=0) log_line(std::cerr) << "graph err: " << rrd_get_error();
 		rrd_clear_error(); 
-
-		event_on = !event_on;
-                window_level = 0; // stop window at event instead of hour end
 	}
 
 }
@@ -26,7 +26,8 @@
 #include <string>
 #include <date/date.h>
 
-void graph(const std::string &vin, const price_entry &price, int window_level, date::sys_time<std::chrono::system_clock::duration> next_event, const vehicle_data &vd = vehicle_data());
+// Write the graph points from the current price until run_end, the next run of the car
+void graph(const std::string &vin, price_list::const_iterator price, price_list::const_iterator prices_end, std::chrono::minutes price_step, date::sys_time<std::chrono::system_clock::duration> run_end, int window_level, date::sys_time<std::chrono::system_clock::duration> next_event, const vehicle_data &vd = vehicle_data());
 
 #endif
 
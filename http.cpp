@@ -0,0 +1,231 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+ 
+#include "http.h"
+#include "retry.h"
+
+#include <curlpp/Options.hpp>
+#include <curlpp/Infos.hpp>
+
+#include <boost/algorithm/string.hpp>
+
+#include <memory>
+#include <stdexcept>
+
+http_session &http_session::instance()
+{
+	static http_session session;
+	return session;
+}
+
+http_session::http_session()
+{
+	m_share = curl_share_init();
+	if (!m_share) throw std::runtime_error("Could not create curl share");
+	curl_share_setopt(m_share, CURLSHOPT_LOCKFUNC, &http_session::lock);
+	curl_share_setopt(m_share, CURLSHOPT_UNLOCKFUNC, &http_session::unlock);
+	curl_share_setopt(m_share, CURLSHOPT_USERDATA, this);
+	curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	// Connections are not shared. libcurl does not support sharing them between concurrent threads.
+	// Each thread's handle keeps its own connections alive instead.
+}
+
+http_session::~http_session()
+{
+	curl_share_cleanup(m_share);
+}
+
+void http_session::lock(CURL *, curl_lock_data data, curl_lock_access, void *session)
+{
+	static_cast<http_session*>(session)->m_locks[data].lock();
+}
+
+void http_session::unlock(CURL *, curl_lock_data data, void *session)
+{
+	static_cast<http_session*>(session)->m_locks[data].unlock();
+}
+
+// The calling thread's handle, reset and prepared for a new request. Reset keeps open
+// connections and caches, so the next request to the same host skips DNS, TCP and TLS setup.
+curlpp::Easy &http_session::handle(const std::string &url, const std::list<std::string> &headers)
+{
+	thread_local std::unique_ptr<curlpp::Easy> r;
+	if (!r) r.reset(new curlpp::Easy);
+	else r->reset();
+
+	CURL *c = r->getHandle();
+	curl_easy_setopt(c, CURLOPT_SHARE, m_share);
+	curl_easy_setopt(c, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+	curl_easy_setopt(c, CURLOPT_TCP_KEEPALIVE, 1L);
+	curl_easy_setopt(c, CURLOPT_ACCEPT_ENCODING, "");
+
+	r->setOpt(new curlpp::options::Url(url));
+	if (!headers.empty()) r->setOpt(new curlpp::options::HttpHeader(headers));
+	return *r;
+}
+
+// Throws http_error on error status, so callers can tell retryable errors from fatal ones
+http_response http_session::perform(curlpp::Easy &r, const std::string &url)
+{
+	http_response response;
+	r.setOpt(new curlpp::options::WriteFunction([&response](char *data, size_t size, size_t count) {
+		response.body.append(data, size * count);
+		return size * count;
+	}));
+	r.setOpt(new curlpp::options::HeaderFunction([&response](char *data, size_t size, size_t count) {
+		// Header names are case insensitive, and lower case with HTTP/2
+		std::string line(data, size * count);
+		const auto colon = line.find(':');
+		if (colon != std::string::npos) {
+			const std::string name = boost::algorithm::to_lower_copy(line.substr(0, colon));
+			const std::string value = boost::algorithm::trim_copy(line.substr(colon + 1));
+			if (name == "etag") response.etag = value;
+			else if (name == "last-modified") response.last_modified = value;
+		}
+		return size * count;
+	}));
+	r.perform();
+	response.status = curlpp::infos::ResponseCode::get(r);
+	if (response.status >= 400) throw http_error(response.status, url);
+	return response;
+}
+
+http_response http_session::get(const std::string &url, const std::list<std::string> &headers)
+{
+	return perform(handle(url, headers), url);
+}
+
+http_response http_session::post(const std::string &url, const std::list<std::string> &headers, const std::string &body)
+{
+	auto &r = handle(url, headers);
+	r.setOpt(new curlpp::options::PostFields(body));
+	r.setOpt(new curlpp::options::PostFieldSize(body.length()));
+	return perform(r, url);
+}
+
+
+http_stream::http_stream(const std::string &url, const std::list<std::string> &headers) : m_url(url), m_easy(http_session::instance().handle(url, headers))
+{
+	m_easy.setOpt(new curlpp::options::WriteFunction([this](char *data, size_t size, size_t count) {
+		// Status is known when the body begins. An error body is not passed to the parser.
+		if (m_status == 0) m_status = curlpp::infos::ResponseCode::get(m_easy);
+		if (m_status < 400) m_buf.append(data, size * count);
+		return size * count;
+	}));
+	const CURLMcode mc = curl_multi_add_handle(multi(), m_easy.getHandle());
+	if (mc != CURLM_OK) throw std::runtime_error(std::string("Could not start transfer: ") + curl_multi_strerror(mc));
+}
+
+http_stream::~http_stream()
+{
+	// Also stops an unfinished transfer
+	curl_multi_remove_handle(multi(), m_easy.getHandle());
+}
+
+// Each thread has its own multi handle, which keeps the connections alive between streams
+CURLM *http_stream::multi()
+{
+	struct multi_handle
+	{
+		CURLM *m { curl_multi_init() };
+		~multi_handle() { curl_multi_cleanup(m); }
+	};
+	thread_local multi_handle h;
+	if (!h.m) throw std::runtime_error("Could not create curl multi handle");
+	return h.m;
+}
+
+// Transfer until more data is received or the transfer ends. Returns false at the end.
+bool http_stream::fill()
+{
+	m_buf.clear();
+	m_pos = 0;
+	while (m_buf.empty() && !m_done) {
+		int running = 0;
+		CURLMcode mc = curl_multi_perform(multi(), &running);
+		if (mc != CURLM_OK) throw std::runtime_error(std::string("Transfer failed: ") + curl_multi_strerror(mc));
+		if (running == 0) {
+			m_done = true;
+			int queued = 0;
+			while (CURLMsg *msg = curl_multi_info_read(multi(), &queued)) {
+				if (msg->msg == CURLMSG_DONE && msg->easy_handle == m_easy.getHandle() && msg->data.result != CURLE_OK) {
+					throw std::runtime_error(std::string("Transfer failed: ") + curl_easy_strerror(msg->data.result));
+				}
+			}
+			m_status = curlpp::infos::ResponseCode::get(m_easy);
+			if (m_status >= 400) throw http_error(m_status, m_url);
+		}
+		else if (m_buf.empty()) {
+			mc = curl_multi_poll(multi(), nullptr, 0, 1000, nullptr);
+			if (mc != CURLM_OK) throw std::runtime_error(std::string("Transfer failed: ") + curl_multi_strerror(mc));
+		}
+	}
+	return !m_buf.empty();
+}
+
+constexpr size_t fetch_pool::thread_count;
+
+fetch_pool &fetch_pool::instance()
+{
+	static fetch_pool pool;
+	return pool;
+}
+
+fetch_pool::fetch_pool()
+{
+	// Create the session first. It is then destroyed after the pool, so the threads and their curl
+	// handles are gone before curl is cleaned up.
+	http_session::instance();
+	for (size_t i = 0; i < thread_count; ++i) m_threads.emplace_back(&fetch_pool::work, this);
+}
+
+fetch_pool::~fetch_pool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_cv.notify_all();
+	for (auto &t : m_threads) t.join();
+}
+
+void fetch_pool::push(std::function<void()> f)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_tasks.push_back(std::move(f));
+	}
+	m_cv.notify_one();
+}
+
+void fetch_pool::work()
+{
+	for (;;) {
+		std::function<void()> f;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cv.wait(lock, [this]() { return m_stop || !m_tasks.empty(); });
+			if (m_tasks.empty()) return;
+			f = std::move(m_tasks.front());
+			m_tasks.pop_front();
+		}
+		f(); // Errors are passed on through the future
+	}
+}
@@ -0,0 +1,157 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#ifndef __HTTP_H
+#define __HTTP_H
+
+#include <curlpp/cURLpp.hpp>
+#include <curlpp/Easy.hpp>
+#include <curl/curl.h>
+
+#include "retry.h"
+
+#include <string>
+#include <list>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+struct http_response
+{
+	long status { 0 };
+	std::string body;
+	std::string etag;
+	std::string last_modified;
+};
+
+// HTTP session shared by all downloads and api calls. Each thread reuses its own curl handle,
+// so connections are kept alive between requests. The DNS and TLS session caches are shared
+// between the threads. HTTP/2 is used where the server supports it.
+class http_session
+{
+	public:
+	static http_session &instance();
+
+	http_response get(const std::string &url, const std::list<std::string> &headers = {});
+	http_response post(const std::string &url, const std::list<std::string> &headers, const std::string &body);
+
+	http_session(const http_session&) = delete;
+	http_session &operator=(const http_session&) = delete;
+
+	protected:
+	friend class http_stream;
+
+	http_session();
+	~http_session();
+
+	curlpp::Easy &handle(const std::string &url, const std::list<std::string> &headers);
+	http_response perform(curlpp::Easy &r, const std::string &url);
+
+	static void lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *session);
+	static void unlock(CURL *handle, curl_lock_data data, void *session);
+
+	curlpp::Cleanup m_cleanup;
+	CURLSH *m_share;
+	std::mutex m_locks[CURL_LOCK_DATA_LAST];
+};
+
+// Response body read while it downloads. It is a rapidjson input stream, so a parser can read
+// the response directly: Peek() and Take() drive the transfer when the received data is used up,
+// and only the latest received data is kept. Uses the calling thread's handle of http_session.
+// Throws http_error on error status, and runtime_error if the transfer fails.
+class http_stream
+{
+	public:
+	typedef char Ch;
+
+	explicit http_stream(const std::string &url, const std::list<std::string> &headers = {});
+	~http_stream();
+
+	Ch Peek() { return (m_pos < m_buf.size() || fill()) ? m_buf[m_pos] : '\0'; }
+	Ch Take() { const Ch c = Peek(); if (c != '\0') { ++m_pos; ++m_count; } return c; }
+	size_t Tell() const { return m_count; }
+
+	// Write functions required by rapidjson. Not used by the parser.
+	Ch *PutBegin() { return nullptr; }
+	void Put(Ch) {}
+	void Flush() {}
+	size_t PutEnd(Ch *) { return 0; }
+
+	http_stream(const http_stream&) = delete;
+	http_stream &operator=(const http_stream&) = delete;
+
+	protected:
+	bool fill();
+	static CURLM *multi();
+
+	std::string m_url;
+	curlpp::Easy &m_easy;
+	std::string m_buf;
+	size_t m_pos { 0 };
+	size_t m_count { 0 };
+	long m_status { 0 };
+	bool m_done { false };
+};
+
+// Threads for downloads running beside the caller, eg a car's calendars while its prices download.
+// The threads live as long as the process, so their curl handles keep connections alive between
+// runs like other threads do. A task must not wait for a task still queued in the pool, as all
+// threads could end up waiting. Waiting for work another thread already runs is fine, eg a shared
+// calendar sync done by the first car to ask for it.
+class fetch_pool
+{
+	public:
+	static fetch_pool &instance();
+
+	// Run f on a pool thread, with the retry deadline of the caller
+	template<class F>
+	auto run(F f) -> std::future<decltype(f())>
+	{
+		auto t = std::make_shared<std::packaged_task<decltype(f())()>>(with_retry_deadline(std::move(f)));
+		auto ret = t->get_future();
+		push([t]() { (*t)(); });
+		return ret;
+	}
+
+	fetch_pool(const fetch_pool&) = delete;
+	fetch_pool &operator=(const fetch_pool&) = delete;
+
+	protected:
+	static constexpr size_t thread_count = 4;
+
+	fetch_pool();
+	~fetch_pool();
+
+	void push(std::function<void()> f);
+	void work();
+
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	bool m_stop { false };
+	std::deque<std::function<void()>> m_tasks;
+	std::vector<std::thread> m_threads;
+};
+
+#endif
+
@@ -0,0 +1,698 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+
+#include "ics.h"
+#include "log.h"
+
+#include <date/date.h>
+#include <date/tz.h>
+
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+typedef std::chrono::system_clock::time_point time_point;
+
+// Limits expansion of rules which never or rarely match, eg BYMONTHDAY=30 with BYMONTH=2
+constexpr long max_periods = 100000;
+
+// Date or date-time value. Times without a zone are UTC.
+struct ics_time
+{
+	date::local_seconds local;
+	const date::time_zone *zone { nullptr };
+	bool date_only { false };
+	bool valid { false };
+};
+
+struct ics_event
+{
+	std::string uid;
+	bool tagged { false };
+	bool cancelled { false };
+	ics_time start;
+	std::string rrule;
+	std::vector<ics_time> exdates;
+	ics_time recurrence_id;
+};
+
+struct ics_rule
+{
+	enum freq_t { daily, weekly, monthly, yearly };
+
+	freq_t freq { daily };
+	long interval { 1 };
+	long count { 0 };                                     // 0 if not limited
+	bool has_until { false };
+	date::sys_seconds until;
+	std::vector<std::pair<int, date::weekday>> by_day;    // Ordinal (0 for every) and weekday
+	std::vector<int> by_month_day;
+	std::vector<date::month> by_month;
+	date::weekday wkst { date::Monday };
+};
+
+struct ics_property
+{
+	std::string name;
+	std::string tzid;
+	std::string value_type;
+	std::string value;
+};
+
+// Logical lines of the calendar. Folded lines are joined and line ends may be \r\n or \n.
+class ics_reader
+{
+	public:
+	explicit ics_reader(const std::string &cal, size_t pos = 0) : m_cal(cal), m_pos(pos) {}
+
+	bool next(std::string &line)
+	{
+		if (m_pos >= m_cal.size()) return false;
+		line.clear();
+		append(line);
+		while (m_pos < m_cal.size() && (m_cal[m_pos] == ' ' || m_cal[m_pos] == '\t')) {
+			++m_pos;
+			append(line);
+		}
+		return true;
+	}
+
+	protected:
+	void append(std::string &line)
+	{
+		size_t end = m_cal.find('\n', m_pos);
+		if (end == std::string::npos) end = m_cal.size();
+		size_t stop = end;
+		if (stop > m_pos && m_cal[stop - 1] == '\r') --stop;
+		line.append(m_cal, m_pos, stop - m_pos);
+		m_pos = end + 1;
+	}
+
+	const std::string &m_cal;
+	size_t m_pos;
+};
+
+// Zones by TZID. A TZID which is not an IANA name is looked up by the X-LIC-LOCATION of its
+// VTIMEZONE and as a Windows zone name, as used by Outlook. Other zones are used as the local zone.
+class zone_cache
+{
+	public:
+	zone_cache() = default;
+	explicit zone_cache(const std::string &cal);
+
+	const date::time_zone *get(const std::string &tzid)
+	{
+		auto i = m_zones.find(tzid);
+		if (i != m_zones.end()) return i->second;
+		const date::time_zone *zone = locate(tzid);
+		auto a = m_aliases.find(tzid);
+		if (!zone && a != m_aliases.end()) zone = locate(a->second);
+		auto w = windows_zones.find(tzid);
+		if (!zone && w != windows_zones.end()) zone = locate(w->second);
+		if (!zone) {
+			try {
+				zone = date::current_zone();
+				log_line() << "Warning: Unknown time zone " << tzid << ", using " << zone->name();
+			}
+			catch (std::exception &) {
+				log_line() << "Warning: Unknown time zone " << tzid << ", using UTC";
+			}
+		}
+		m_zones[tzid] = zone;
+		return zone;
+	}
+
+	protected:
+	static const date::time_zone *locate(const std::string &name)
+	{
+		try {
+			return date::locate_zone(name);
+		}
+		catch (std::exception &) {
+			return nullptr;
+		}
+	}
+
+	static const std::map<std::string, std::string> windows_zones;
+
+	std::map<std::string, const date::time_zone*> m_zones;
+	std::map<std::string, std::string> m_aliases;   // X-LIC-LOCATION by TZID
+};
+
+// The common Windows zone names, from the CLDR windowsZones table
+const std::map<std::string, std::string> zone_cache::windows_zones {
+	{ "UTC", "Etc/UTC" },
+	{ "GMT Standard Time", "Europe/London" },
+	{ "Greenwich Standard Time", "Atlantic/Reykjavik" },
+	{ "W. Europe Standard Time", "Europe/Berlin" },
+	{ "Romance Standard Time", "Europe/Paris" },
+	{ "Central Europe Standard Time", "Europe/Budapest" },
+	{ "Central European Standard Time", "Europe/Warsaw" },
+	{ "E. Europe Standard Time", "Europe/Chisinau" },
+	{ "FLE Standard Time", "Europe/Kiev" },
+	{ "GTB Standard Time", "Europe/Bucharest" },
+	{ "Russian Standard Time", "Europe/Moscow" },
+	{ "Eastern Standard Time", "America/New_York" },
+	{ "Central Standard Time", "America/Chicago" },
+	{ "Mountain Standard Time", "America/Denver" },
+	{ "US Mountain Standard Time", "America/Phoenix" },
+	{ "Pacific Standard Time", "America/Los_Angeles" },
+	{ "China Standard Time", "Asia/Shanghai" },
+	{ "Tokyo Standard Time", "Asia/Tokyo" },
+	{ "India Standard Time", "Asia/Calcutta" },
+	{ "AUS Eastern Standard Time", "Australia/Sydney" },
+};
+
+std::string upper(std::string s)
+{
+	std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return std::toupper(c); });
+	return s;
+}
+
+// Value of the digits s[pos, pos+n), or -1 if one is not a digit
+int digits(const std::string &s, size_t pos, size_t n)
+{
+	if (pos + n > s.size()) return -1;
+	int v = 0;
+	for (size_t i = pos; i < pos + n; ++i) {
+		if (s[i] < '0' || s[i] > '9') return -1;
+		v = v * 10 + (s[i] - '0');
+	}
+	return v;
+}
+
+bool parse_property(const std::string &line, ics_property &p)
+{
+	p.name.clear();
+	p.tzid.clear();
+	p.value_type.clear();
+	p.value.clear();
+
+	size_t i = 0;
+	while (i < line.size() && line[i] != ';' && line[i] != ':') p.name += std::toupper(static_cast<unsigned char>(line[i++]));
+	while (i < line.size() && line[i] == ';') {
+		++i;
+		std::string name, value;
+		while (i < line.size() && line[i] != '=' && line[i] != ';' && line[i] != ':') name += std::toupper(static_cast<unsigned char>(line[i++]));
+		if (i < line.size() && line[i] == '=') {
+			++i;
+			bool quoted = false;
+			for (; i < line.size() && (quoted || (line[i] != ';' && line[i] != ':')); ++i) {
+				if (line[i] == '"') quoted = !quoted;
+				else value += line[i];
+			}
+		}
+		if (name == "TZID") p.tzid = value;
+		else if (name == "VALUE") p.value_type = upper(value);
+	}
+	if (i >= line.size() || line[i] != ':') return false;
+	p.value.assign(line, i + 1, std::string::npos);
+	return true;
+}
+
+zone_cache::zone_cache(const std::string &cal)
+{
+	for (size_t pos = cal.find("BEGIN:VTIMEZONE"); pos != std::string::npos; pos = cal.find("BEGIN:VTIMEZONE", pos + 1)) {
+		ics_reader reader(cal, pos);
+		std::string line, tzid, location;
+		ics_property p;
+		while (reader.next(line)) {
+			if (!parse_property(line, p)) continue;
+			if (p.name == "END" && upper(p.value) == "VTIMEZONE") break;
+			if (p.name == "TZID") tzid = p.value;
+			else if (p.name == "X-LIC-LOCATION") location = p.value;
+		}
+		if (!tzid.empty() && !location.empty()) m_aliases[tzid] = location;
+	}
+}
+
+// "YYYYMMDD" or "YYYYMMDDTHHMMSS" with an optional Z for UTC
+ics_time parse_time(const std::string &value, const std::string &tzid, const std::string &value_type, zone_cache &zones)
+{
+	ics_time t;
+	const int y = digits(value, 0, 4), mo = digits(value, 4, 2), d = digits(value, 6, 2);
+	if (y < 0 || mo < 0 || d < 0) return t;
+	const date::year_month_day ymd { date::year(y), date::month(mo), date::day(d) };
+	if (!ymd.ok()) return t;
+	t.local = date::local_days(ymd);
+
+	if (value.size() == 8 || value_type == "DATE") {
+		t.date_only = true;
+	}
+	else {
+		const int h = digits(value, 9, 2), mi = digits(value, 11, 2), s = digits(value, 13, 2);
+		if (value.size() < 15 || value[8] != 'T' || h < 0 || h > 23 || mi < 0 || mi > 59 || s < 0 || s > 60) return t;
+		t.local += std::chrono::hours(h) + std::chrono::minutes(mi) + std::chrono::seconds(s);
+		const bool utc = value.size() > 15 && value[15] == 'Z';
+		if (!utc && !tzid.empty()) t.zone = zones.get(tzid);
+	}
+	t.valid = true;
+	return t;
+}
+
+date::sys_seconds to_sys(date::local_seconds local, const date::time_zone *zone)
+{
+	// Times skipped by DST move forward, and repeated times use the first one
+	return zone ? zone->to_sys(local, date::choose::earliest) : date::sys_seconds(local.time_since_epoch());
+}
+
+bool parse_weekday(const std::string &s, date::weekday &wd)
+{
+	static const char *const names[] = { "SU", "MO", "TU", "WE", "TH", "FR", "SA" };
+	for (unsigned i = 0; i < 7; ++i) {
+		if (s == names[i]) {
+			wd = date::weekday(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+// Returns false if the rule uses parts that are not supported. The zone and start of the
+// event are needed for an UNTIL without zone.
+bool parse_rule(const std::string &s, const ics_time &start, ics_rule &r)
+{
+	bool has_freq = false;
+	size_t pos = 0;
+	while (pos < s.size()) {
+		size_t end = s.find(';', pos);
+		if (end == std::string::npos) end = s.size();
+		const std::string part = s.substr(pos, end - pos);
+		pos = end + 1;
+		const size_t eq = part.find('=');
+		if (eq == std::string::npos) continue;
+		const std::string key = upper(part.substr(0, eq));
+		const std::string value = upper(part.substr(eq + 1));
+
+		// Comma separated list
+		std::vector<std::string> items;
+		for (size_t i = 0; i <= value.size(); ) {
+			size_t j = value.find(',', i);
+			if (j == std::string::npos) j = value.size();
+			items.push_back(value.substr(i, j - i));
+			i = j + 1;
+		}
+
+		try {
+			if (key == "FREQ") {
+				if (value == "DAILY") r.freq = ics_rule::daily;
+				else if (value == "WEEKLY") r.freq = ics_rule::weekly;
+				else if (value == "MONTHLY") r.freq = ics_rule::monthly;
+				else if (value == "YEARLY") r.freq = ics_rule::yearly;
+				else return false;
+				has_freq = true;
+			}
+			else if (key == "INTERVAL") {
+				r.interval = std::stol(value);
+				if (r.interval < 1) return false;
+			}
+			else if (key == "COUNT") {
+				r.count = std::stol(value);
+				if (r.count < 1) return false;
+			}
+			else if (key == "UNTIL") {
+				zone_cache none;
+				const ics_time until = parse_time(value, "", "", none);
+				if (!until.valid) return false;
+				const bool utc = value.size() > 15 && value[15] == 'Z';
+				// A date includes the whole day. Without Z the time is in the zone of the start.
+				const date::local_seconds local = until.date_only ? until.local + date::days(1) - std::chrono::seconds(1) : until.local;
+				r.until = utc ? to_sys(local, nullptr) : to_sys(local, start.zone);
+				r.has_until = true;
+			}
+			else if (key == "BYDAY") {
+				for (auto &i : items) {
+					if (i.size() < 2) return false;
+					date::weekday wd;
+					if (!parse_weekday(i.substr(i.size() - 2), wd)) return false;
+					const int n = i.size() > 2 ? std::stoi(i.substr(0, i.size() - 2)) : 0;
+					r.by_day.push_back({ n, wd });
+				}
+			}
+			else if (key == "BYMONTHDAY") {
+				for (auto &i : items) {
+					const int d = std::stoi(i);
+					if (d == 0 || d < -31 || d > 31) return false;
+					r.by_month_day.push_back(d);
+				}
+			}
+			else if (key == "BYMONTH") {
+				for (auto &i : items) {
+					const int m = std::stoi(i);
+					if (m < 1 || m > 12) return false;
+					r.by_month.push_back(date::month(m));
+				}
+			}
+			else if (key == "WKST") {
+				if (!parse_weekday(value, r.wkst)) return false;
+			}
+			else {
+				return false; // BYSETPOS, BYHOUR, BYWEEKNO, ...
+			}
+		}
+		catch (std::exception &) {
+			return false; // Not a number
+		}
+	}
+	return has_freq;
+}
+
+bool has_month(const ics_rule &r, date::month m)
+{
+	return r.by_month.empty() || std::find(r.by_month.begin(), r.by_month.end(), m) != r.by_month.end();
+}
+
+bool has_weekday(const ics_rule &r, date::weekday wd)
+{
+	for (auto &i : r.by_day) if (i.second == wd) return true;
+	return false;
+}
+
+bool has_month_day(const ics_rule &r, const date::year_month_day &ymd)
+{
+	const int last = unsigned((ymd.year() / ymd.month() / date::last).day());
+	const int d = unsigned(ymd.day());
+	for (int md : r.by_month_day) if (md == d || last + 1 + md == d) return true;
+	return false;
+}
+
+// Dates of a month matching BYMONTHDAY and BYDAY, or day if neither is given
+void month_dates(const ics_rule &r, date::year_month ym, date::day day, std::vector<date::local_days> &out)
+{
+	const int last = unsigned((ym / date::last).day());
+	if (!r.by_month_day.empty()) {
+		for (int md : r.by_month_day) {
+			const int d = md > 0 ? md : last + 1 + md;
+			if (d < 1 || d > last) continue;
+			const date::local_days ld { ym / unsigned(d) };
+			if (r.by_day.empty() || has_weekday(r, date::weekday(ld))) out.push_back(ld);
+		}
+	}
+	else if (!r.by_day.empty()) {
+		for (auto &i : r.by_day) {
+			if (i.first == 0) {
+				for (unsigned n = 1; n <= 5; ++n) {
+					const auto ymwd = ym / i.second[n];
+					if (ymwd.ok()) out.push_back(date::local_days(ymwd));
+				}
+			}
+			else if (i.first > 0) {
+				if (i.first > 5) continue;
+				const auto ymwd = ym / i.second[unsigned(i.first)];
+				if (ymwd.ok()) out.push_back(date::local_days(ymwd));
+			}
+			else {
+				const date::local_days ld = date::local_days(ym / i.second[date::last]) - date::days(7 * (-i.first - 1));
+				if (date::year_month_day(ld).month() == ym.month()) out.push_back(ld);
+			}
+		}
+	}
+	else if (day <= date::day(last)) {
+		out.push_back(date::local_days(ym / day));
+	}
+}
+
+// Dates of a year matching BYDAY, with ordinals counted in the year
+void year_weekdays(const ics_rule &r, date::year y, std::vector<date::local_days> &out)
+{
+	const date::local_days first { y / date::January / 1 };
+	const date::local_days last { y / date::December / 31 };
+	for (auto &i : r.by_day) {
+		const date::local_days first_wd = first + (i.second - date::weekday(first));
+		const date::local_days last_wd = last - (date::weekday(last) - i.second);
+		if (i.first == 0) {
+			for (auto d = first_wd; d <= last; d += date::days(7)) out.push_back(d);
+		}
+		else if (i.first > 0) {
+			const auto d = first_wd + date::days(7 * (i.first - 1));
+			if (d <= last) out.push_back(d);
+		}
+		else {
+			const auto d = last_wd - date::days(7 * (-i.first - 1));
+			if (d >= first) out.push_back(d);
+		}
+	}
+}
+
+// Recurrence periods of a rule. Period k is the k'th day, week, month or year stepped by INTERVAL from the start.
+class rule_periods
+{
+	public:
+	rule_periods(const ics_rule &r, date::local_days start) : m_rule(r), m_start(start), m_first(start), m_week0(start - (date::weekday(start) - r.wkst)) {}
+
+	date::local_days begin(long k) const
+	{
+		switch (m_rule.freq) {
+		case ics_rule::daily: return m_start + date::days(k * m_rule.interval);
+		case ics_rule::weekly: return m_week0 + date::days(7 * k * m_rule.interval);
+		case ics_rule::monthly: return date::local_days(month(k) / 1);
+		case ics_rule::yearly: return date::local_days(year(k) / date::January / 1);
+		}
+		return m_start;
+	}
+
+	// Last period beginning at or before day
+	long at(date::local_days day) const
+	{
+		long n = 0;
+		switch (m_rule.freq) {
+		case ics_rule::daily: n = (day - m_start).count(); break;
+		case ics_rule::weekly: n = (day - m_week0).count() / 7; break;
+		case ics_rule::monthly: {
+			const date::year_month_day ymd { day };
+			n = (int(ymd.year()) - int(m_first.year())) * 12 + (int(unsigned(ymd.month())) - int(unsigned(m_first.month())));
+			break;
+		}
+		case ics_rule::yearly: n = int(date::year_month_day(day).year()) - int(m_first.year()); break;
+		}
+		return n < 0 ? 0 : n / m_rule.interval;
+	}
+
+	// Candidate dates of period k, sorted
+	void dates(long k, std::vector<date::local_days> &out) const
+	{
+		out.clear();
+		switch (m_rule.freq) {
+		case ics_rule::daily: {
+			const auto d = begin(k);
+			const date::year_month_day ymd { d };
+			if (has_month(m_rule, ymd.month()) && (m_rule.by_month_day.empty() || has_month_day(m_rule, ymd)) && (m_rule.by_day.empty() || has_weekday(m_rule, date::weekday(d)))) out.push_back(d);
+			break;
+		}
+		case ics_rule::weekly: {
+			const auto week = begin(k);
+			for (int i = 0; i < 7; ++i) {
+				const auto d = week + date::days(i);
+				const bool day = m_rule.by_day.empty() ? date::weekday(d) == date::weekday(m_start) : has_weekday(m_rule, date::weekday(d));
+				if (day && has_month(m_rule, date::year_month_day(d).month())) out.push_back(d);
+			}
+			break;
+		}
+		case ics_rule::monthly: {
+			const auto ym = month(k);
+			if (has_month(m_rule, ym.month())) month_dates(m_rule, ym, m_first.day(), out);
+			break;
+		}
+		case ics_rule::yearly: {
+			const auto y = year(k);
+			if (m_rule.by_month.empty() && m_rule.by_month_day.empty() && !m_rule.by_day.empty()) {
+				year_weekdays(m_rule, y, out);
+			}
+			else if (m_rule.by_month.empty()) {
+				month_dates(m_rule, y / m_first.month(), m_first.day(), out);
+			}
+			else {
+				for (auto m : m_rule.by_month) month_dates(m_rule, y / m, m_first.day(), out);
+			}
+			break;
+		}
+		}
+		std::sort(out.begin(), out.end());
+		out.erase(std::unique(out.begin(), out.end()), out.end());
+	}
+
+	// Number of candidates in each period, if it is the same for all periods
+	long fixed_size() const
+	{
+		if (!m_rule.by_month.empty() || !m_rule.by_month_day.empty()) return 0;
+		if (m_rule.freq == ics_rule::daily) return m_rule.by_day.empty() ? 1 : 0;
+		if (m_rule.freq != ics_rule::weekly) return 0;
+		if (m_rule.by_day.empty()) return 1;
+		std::vector<date::weekday> days;
+		for (auto &i : m_rule.by_day) {
+			if (i.first != 0) return 0;
+			if (std::find(days.begin(), days.end(), i.second) == days.end()) days.push_back(i.second);
+		}
+		return days.size();
+	}
+
+	protected:
+	date::year_month month(long k) const { return date::year_month(m_first.year(), m_first.month()) + date::months(k * m_rule.interval); }
+	date::year year(long k) const { return m_first.year() + date::years(k * m_rule.interval); }
+
+	const ics_rule &m_rule;
+	date::local_days m_start;
+	date::year_month_day m_first;
+	date::local_days m_week0;    // Start of the week of the first period
+};
+
+void add(date::sys_seconds t, time_point from, time_point to, const std::vector<date::sys_seconds> &excluded, std::vector<time_point> &out)
+{
+	if (t >= from && t <= to && !std::binary_search(excluded.begin(), excluded.end(), t)) out.push_back(t);
+}
+
+// Occurrences of e in from-to. Excluded are the sorted times of EXDATE and overridden occurrences.
+void expand(const ics_event &e, time_point from, time_point to, const std::vector<date::sys_seconds> &excluded, std::vector<time_point> &out)
+{
+	const date::sys_seconds start_sys = to_sys(e.start.local, e.start.zone);
+	if (e.rrule.empty()) {
+		add(start_sys, from, to, excluded, out);
+		return;
+	}
+
+	ics_rule r;
+	if (!parse_rule(e.rrule, e.start, r)) {
+		log_line() << "Warning: Unsupported RRULE " << e.rrule << ", using first event only";
+		add(start_sys, from, to, excluded, out);
+		return;
+	}
+
+	// DTSTART is the first occurrence, also if it does not match the rule
+	if (r.has_until && start_sys > r.until) return;
+	add(start_sys, from, to, excluded, out);
+	long count = 1;
+
+	const date::local_days start_day = date::floor<date::days>(e.start.local);
+	const auto time_of_day = e.start.local - start_day;
+	const rule_periods periods(r, start_day);
+
+	// Local days around from-to. A day of margin covers any zone offset.
+	const date::local_days from_day { date::floor<date::days>(from.time_since_epoch()) - date::days(1) };
+	const date::local_days to_day { date::floor<date::days>(to.time_since_epoch()) + date::days(1) };
+
+	// Jump to the periods near from. With COUNT, the occurrences skipped must be counted, which
+	// is only known without iterating when each period has the same number of them.
+	std::vector<date::local_days> dates;
+	long k = 0;
+	const long fixed = periods.fixed_size();
+	if (r.count == 0 || fixed > 0) k = std::max(0L, periods.at(from_day) - 1);
+	if (r.count != 0 && k > 0) {
+		periods.dates(0, dates);
+		const long first = std::count_if(dates.begin(), dates.end(), [&](date::local_days d) { return d + time_of_day > e.start.local; });
+		count += first + (k - 1) * fixed;
+		if (count >= r.count) return;
+	}
+
+	for (long n = 0; n < max_periods && periods.begin(k) <= to_day; ++n, ++k) {
+		periods.dates(k, dates);
+		for (auto d : dates) {
+			const date::local_seconds local = d + time_of_day;
+			if (local <= e.start.local) continue;
+			const date::sys_seconds t = to_sys(local, e.start.zone);
+			if (r.has_until && t > r.until) return;
+			if (r.count != 0 && ++count > r.count) return;
+			add(t, from, to, excluded, out);
+		}
+	}
+}
+
+}
+
+std::vector<time_point> ics_event_starts(const std::string &cal, const std::string &tag, time_point from, time_point to)
+{
+	zone_cache zones(cal);
+	std::vector<ics_event> events;      // Tagged events and series
+	std::vector<ics_event> overrides;   // Changed occurrences of series, with or without the tag
+
+	ics_reader reader(cal);
+	std::string line;
+	ics_property p;
+	ics_event e;
+	bool in_event = false;
+	int nested = 0;      // Depth of components inside the event, eg VALARM
+	while (reader.next(line)) {
+		if (!parse_property(line, p)) continue;
+		if (p.name == "BEGIN") {
+			if (in_event) ++nested;
+			else if (upper(p.value) == "VEVENT") {
+				in_event = true;
+				e = ics_event();
+			}
+			continue;
+		}
+		if (p.name == "END") {
+			if (nested > 0) --nested;
+			else if (in_event && upper(p.value) == "VEVENT") {
+				in_event = false;
+				// Only the tagged series are expanded
+				if (e.recurrence_id.valid) overrides.push_back(std::move(e));
+				else if (e.tagged) events.push_back(std::move(e));
+			}
+			continue;
+		}
+		if (!in_event || nested > 0) continue;
+
+		if (p.name == "UID") e.uid = p.value;
+		else if (p.name == "SUMMARY") e.tagged = p.value.find(tag) != std::string::npos;
+		else if (p.name == "STATUS") e.cancelled = upper(p.value) == "CANCELLED";
+		else if (p.name == "DTSTART") e.start = parse_time(p.value, p.tzid, p.value_type, zones);
+		else if (p.name == "RRULE") e.rrule = p.value;
+		else if (p.name == "RECURRENCE-ID") e.recurrence_id = parse_time(p.value, p.tzid, p.value_type, zones);
+		else if (p.name == "EXDATE") {
+			for (size_t i = 0; i < p.value.size(); ) {
+				size_t j = p.value.find(',', i);
+				if (j == std::string::npos) j = p.value.size();
+				auto t = parse_time(p.value.substr(i, j - i), p.tzid, p.value_type, zones);
+				if (t.valid) e.exdates.push_back(t);
+				i = j + 1;
+			}
+		}
+	}
+
+	std::vector<time_point> starts;
+	std::map<std::string, std::vector<date::sys_seconds>> replaced;
+	for (auto &o : overrides) {
+		replaced[o.uid].push_back(to_sys(o.recurrence_id.local, o.recurrence_id.zone));
+		if (o.tagged && !o.cancelled && o.start.valid && !o.start.date_only) add(to_sys(o.start.local, o.start.zone), from, to, {}, starts);
+	}
+
+	for (auto &i : events) {
+		if (i.cancelled || !i.start.valid || i.start.date_only) continue;
+		std::vector<date::sys_seconds> excluded;
+		auto r = replaced.find(i.uid);
+		if (r != replaced.end()) excluded = r->second;
+		for (auto &x : i.exdates) {
+			// A date excludes the occurrence of that day
+			if (x.date_only) excluded.push_back(to_sys(x.local + (i.start.local - date::floor<date::days>(i.start.local)), i.start.zone));
+			else excluded.push_back(to_sys(x.local, x.zone));
+		}
+		std::sort(excluded.begin(), excluded.end());
+		expand(i, from, to, excluded, starts);
+	}
+
+	std::sort(starts.begin(), starts.end());
+	starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+	return starts;
+}
@@ -0,0 +1,36 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+
+#ifndef __ICS_H
+#define __ICS_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Start times in from-to (both included) of the events of an iCalendar (RFC 5545) with tag in
+// the summary, sorted. Recurrences are expanded in the time zone of each event. Only events
+// with the tag are expanded, and expansion starts at the first recurrence period that can
+// reach from. Supported RRULE parts are FREQ (DAILY, WEEKLY, MONTHLY, YEARLY), INTERVAL,
+// COUNT, UNTIL, BYDAY, BYMONTHDAY, BYMONTH and WKST. EXDATE, RECURRENCE-ID overrides and
+// cancelled events are handled. All day events are skipped, as they have no time to charge for.
+std::vector<std::chrono::system_clock::time_point> ics_event_starts(const std::string &cal, const std::string &tag, std::chrono::system_clock::time_point from, std::chrono::system_clock::time_point to);
+
+#endif
@@ -0,0 +1,89 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+ 
+#include "json_records.h"
+
+#include <cstring>
+
+const json_field *json_record::find(const char *key) const
+{
+	for (size_t i = 0; i < m_count; ++i) {
+		if (m_fields[i].key == key) return &m_fields[i];
+	}
+	return nullptr;
+}
+
+bool json_record_handler::value(json_field::type_t type, double number, const char *str, size_t length)
+{
+	if (in_record() && m_pending) {
+		json_field &f = m_record.m_fields[m_record.m_count - 1];
+		f.type = type;
+		f.number = number;
+		if (str) f.text.assign(str, length);
+		else f.text.clear();
+		m_pending = false;
+	}
+	return true;
+}
+
+bool json_record_handler::String(const char *str, rapidjson::SizeType length, bool)
+{
+	return value(json_field::string_type, 0, str, length);
+}
+
+bool json_record_handler::Key(const char *str, rapidjson::SizeType length, bool)
+{
+	if (m_depth == 1) m_key.assign(str, length);
+	else if (in_record()) {
+		if (m_record.m_count == m_record.m_fields.size()) m_record.m_fields.emplace_back();
+		m_record.m_fields[m_record.m_count++].key.assign(str, length);
+		m_pending = true;
+	}
+	return true;
+}
+
+bool json_record_handler::StartObject()
+{
+	value(json_field::other_type); // An object as value of a record field
+	++m_depth;
+	if (in_record()) m_record.m_count = 0;
+	return true;
+}
+
+bool json_record_handler::EndObject(rapidjson::SizeType)
+{
+	if (in_record()) m_f(m_record);
+	--m_depth;
+	return true;
+}
+
+bool json_record_handler::StartArray()
+{
+	value(json_field::other_type); // An array as value of a record field
+	++m_depth;
+	if (m_depth == 2 && m_key == m_array) m_in_array = m_found = true;
+	return true;
+}
+
+bool json_record_handler::EndArray(rapidjson::SizeType)
+{
+	if (m_depth == 2) m_in_array = false;
+	--m_depth;
+	return true;
+}
@@ -0,0 +1,105 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+
+#ifndef __JSON_RECORDS_H
+#define __JSON_RECORDS_H
+
+#include <rapidjson/reader.h>
+#include <rapidjson/error/en.h>
+
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+struct json_field
+{
+	enum type_t { null_type, number_type, string_type, other_type };
+
+	std::string key;
+	type_t type { null_type };
+	double number { 0 };
+	std::string text;
+};
+
+// Fields of one record. The fields are reused for the next record, so their strings keep their capacity.
+class json_record
+{
+	public:
+	const json_field *find(const char *key) const;
+	bool has(const char *key) const { return find(key) != nullptr; }
+
+	protected:
+	friend class json_record_handler;
+	std::vector<json_field> m_fields;
+	size_t m_count { 0 };
+};
+
+// SAX handler passing each record of an array member of the root object to a callback.
+// Values nested inside records are not kept.
+class json_record_handler : public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, json_record_handler>
+{
+	public:
+	json_record_handler(const std::string &array, const std::function<void(const json_record&)> &f) : m_array(array), m_f(f) {}
+
+	bool found() const { return m_found; }
+
+	bool Default() { return value(json_field::other_type); }
+	bool Null() { return value(json_field::null_type); }
+	bool Int(int i) { return value(json_field::number_type, i); }
+	bool Uint(unsigned u) { return value(json_field::number_type, u); }
+	bool Int64(int64_t i) { return value(json_field::number_type, i); }
+	bool Uint64(uint64_t u) { return value(json_field::number_type, u); }
+	bool Double(double d) { return value(json_field::number_type, d); }
+	bool String(const char *str, rapidjson::SizeType length, bool);
+	bool Key(const char *str, rapidjson::SizeType length, bool);
+	bool StartObject();
+	bool EndObject(rapidjson::SizeType);
+	bool StartArray();
+	bool EndArray(rapidjson::SizeType);
+
+	protected:
+	bool value(json_field::type_t type, double number = 0, const char *str = nullptr, size_t length = 0);
+	bool in_record() const { return m_in_array && m_depth == 3; }
+
+	const std::string &m_array;
+	const std::function<void(const json_record&)> &m_f;
+	json_record m_record;
+	std::string m_key;         // Last key of the root object
+	int m_depth { 0 };
+	bool m_in_array { false };
+	bool m_found { false };
+	bool m_pending { false };  // Record key waiting for its value
+};
+
+// Reads json from in and calls f for each record of the array 'array' in the root object, as the
+// records are parsed. The whole document is never held in memory. Returns false if there is no such
+// array, and throws if the json is invalid.
+template<class stream>
+bool read_json_records(stream &in, const std::string &array, const std::function<void(const json_record&)> &f)
+{
+	json_record_handler handler(array, f);
+	rapidjson::Reader reader;
+	rapidjson::ParseResult ok = reader.Parse(in, handler);
+	if (!ok) throw std::runtime_error(std::string("Invalid json: ") + rapidjson::GetParseError_En(ok.Code()) + " at " + std::to_string(ok.Offset()));
+	return handler.found();
+}
+
+#endif
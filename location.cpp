@@ -17,12 +17,22 @@
  ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
  *************************************************************************/
 
-#include <rapidjson/document.h>
-#include <rapidjson/memorystream.h>
 #include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 #include "location.h"
 #include "elnet-forsyningsgraenser.h"
+#include "log.h"
 
 namespace {
 
@@ -45,79 +55,455 @@ double distance(const location& a, const location& b)
 	return d;
 }
 
-bool in_poly(const location& loc, const polygon& poly)
+namespace {
+
+// Packed elnet boundaries. See elnet-pack.py for the layout.
+struct elnet_bbox
+{
+   int32_t lat_min;
+   int32_t lat_max;
+   int32_t lon_min;
+   int32_t lon_max;
+
+   bool contains(int32_t lat, int32_t lon) const { return lat >= lat_min && lat <= lat_max && lon >= lon_min && lon <= lon_max; }
+};
+
+struct elnet_header
+{
+   char magic[4];
+   uint32_t version;
+   uint32_t feature_count;
+   uint32_t ring_count;
+   uint32_t coord_count;
+   uint32_t grid_size;
+   uint32_t cell_feature_count;
+   uint32_t names_size;
+   elnet_bbox box;
+};
+
+struct elnet_feature
+{
+   elnet_bbox box;
+   uint32_t first_ring;
+   uint32_t ring_count;
+   uint32_t name_offset;
+   uint32_t name_size;
+   uint32_t multi;      // MultiPolygon. Rings of a part are combined, where a ring inside another is a hole.
+   uint32_t reserved;
+};
+
+struct elnet_ring
+{
+   elnet_bbox box;
+   uint32_t first;      // Index of first coordinate
+   uint32_t count;
+   uint32_t part;       // Polygon of a multipolygon this ring belongs to
+   uint32_t reserved;
+};
+
+static_assert(sizeof(elnet_header) == 48 && sizeof(elnet_feature) == 40 && sizeof(elnet_ring) == 32, "elnet layout must match elnet-pack.py");
+
+constexpr uint32_t elnet_version = 1;
+constexpr double elnet_scale = 1e-7; // degrees per coordinate unit
+const char elnet_file[] = "/usr/local/share/tesla-cron/elnet.bin";
+
+// Crossing number test of edge a-b of a ring
+inline bool crosses(const location& loc, double r, const int32_t *lat, const int32_t *lon, uint32_t a, uint32_t b)
+{
+   const double lat_a = lat[a] * elnet_scale, lat_b = lat[b] * elnet_scale;
+   if (((lat_a > loc.lat()) != (lat_b > loc.lat()))) {
+      // loc.lat is within the range ib.lat;ai.lat).
+
+      // use 2d interpolation. Good enough for small areas.
+      const double lon_a = lon[a] * elnet_scale, lon_b = lon[b] * elnet_scale;
+      if ((loc.lon()*r < (lon_b*r - lon_a*r) * (loc.lat() - lat_a) / (lat_b - lat_a) + lon_a*r)) { 
+         // loc.lon is below the ia;ib line
+         return true;
+      }
+   }
+   return false;
+}
+
+// Crossing number test of one ring. Coordinates are in flat lat/lon arrays.
+// Used where there is no vectorized version, and as reference for the vectorized ones.
+bool in_poly_scalar(const location& loc, const int32_t *lat, const int32_t *lon, uint32_t count)
 {
    bool in = false;
-   //double dist = std::numeric_limits<double>::max();
    const double r = cos(loc.lat()); // lon/lat ratio at loc. To get aprox 1:1 lon/lat relation 
-   for (auto ia = poly.begin(), ib = ia + poly.size()-1; ia != poly.end(); ib = ia++) {
-      //dist = std::min(dist, distance(loc, *ia));
-      if (((ia->lat() > loc.lat()) != (ib->lat() > loc.lat()))) {
-         // loc.lat is within the range ib.lat;ai.lat).
-
-         // use 2d interpolation. Good enough for small areas.
-         if ((loc.lon()*r < (ib->lon()*r - ia->lon()*r) * (loc.lat() - ia->lat()) / (ib->lat() - ia->lat()) + ia->lon()*r)) { 
-            // loc.lon is below the ia;ib line
-            in = !in;
-         }
-      }
+   for (uint32_t a = 0, b = count - 1; a < count; b = a++) {
+      if (crosses(loc, r, lat, lon, a, b)) in = !in;
    }
    return in;
 }
 
-std::string get_elnet(location loc)
+#if defined(__x86_64__)
+// Vectorized versions of in_poly_scalar. Edge 0 closes the ring and is tested as in the scalar
+// version, edges a-1;a from a=1 are tested several at a time. The arithmetic is the same as in
+// crosses(), without fused multiply-add, so results are identical to the scalar version.
+
+bool in_poly_sse2(const location& loc, const int32_t *lat, const int32_t *lon, uint32_t count)
 {
-   using namespace rapidjson;
-   MemoryStream input(elnet_json(), elnet_json_len());
-   Document doc;
-   doc.ParseStream(input);
-   std::string found_name;
-
-   const Value& feat = doc["features"];
-   if (!feat.IsArray()) throw std::runtime_error("Unexpeted elnet format");
-   for (auto& f : feat.GetArray()) {
-      const Value& properties = f["properties"];
-      const Value& navn = properties["Selsk_Nvn"];
-      const Value& nr = properties["Selsk_Nr"];
-      const Value& type = f["geometry"]["type"];
-      const Value& coordinates = f["geometry"]["coordinates"];
-      if (!navn.IsString()) throw std::runtime_error("Unexpeted elnet navn format");
-      if (!nr.IsInt()) throw std::runtime_error("Unexpeted elnet nr format");
-      if (!type.IsString()) throw std::runtime_error("Unexpeted elnet type format");
-      if (!coordinates.IsArray()) throw std::runtime_error("Unexpeted elnet coordinates format");
-      //std::cout << "Navn: " << nr.GetInt() << ' ' << navn.GetString() << std::endl;
-      if (type.GetString() == std::string("Polygon")) {
-         for (auto& p : coordinates.GetArray()) {
-            polygon poly;
-            for (auto& c : p.GetArray()) poly.emplace_back(c[1].GetDouble(), c[0].GetDouble());
-            auto in = in_poly(loc, poly);
-            if (in) {
-               //std::cout << "found: " << dist << std::endl;
-               return navn.GetString();
-            }
+   const double r = cos(loc.lat());
+   bool in = crosses(loc, r, lat, lon, 0, count - 1);
+
+   const __m128d scale = _mm_set1_pd(elnet_scale);
+   const __m128d vr = _mm_set1_pd(r);
+   const __m128d y = _mm_set1_pd(loc.lat());
+   const __m128d x = _mm_set1_pd(loc.lon()*r);
+   int hits = 0;
+   uint32_t a = 1;
+   for (; a + 2 <= count; a += 2) {
+      const __m128d lat_a = _mm_mul_pd(_mm_cvtepi32_pd(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(lat + a))), scale);
+      const __m128d lat_b = _mm_mul_pd(_mm_cvtepi32_pd(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(lat + a - 1))), scale);
+      const __m128d lon_a = _mm_mul_pd(_mm_cvtepi32_pd(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(lon + a))), scale);
+      const __m128d lon_b = _mm_mul_pd(_mm_cvtepi32_pd(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(lon + a - 1))), scale);
+      const __m128d within = _mm_xor_pd(_mm_cmpgt_pd(lat_a, y), _mm_cmpgt_pd(lat_b, y));
+      if (!_mm_movemask_pd(within)) continue; // Most edges are not level with loc
+      const __m128d lon_ar = _mm_mul_pd(lon_a, vr);
+      const __m128d edge = _mm_add_pd(_mm_div_pd(_mm_mul_pd(_mm_sub_pd(_mm_mul_pd(lon_b, vr), lon_ar), _mm_sub_pd(y, lat_a)), _mm_sub_pd(lat_b, lat_a)), lon_ar);
+      hits += __builtin_popcount(_mm_movemask_pd(_mm_and_pd(within, _mm_cmplt_pd(x, edge))));
+   }
+   for (; a < count; ++a) {
+      if (crosses(loc, r, lat, lon, a, a - 1)) in = !in;
+   }
+   return in != (hits & 1);
+}
+
+__attribute__((target("avx")))
+bool in_poly_avx(const location& loc, const int32_t *lat, const int32_t *lon, uint32_t count)
+{
+   const double r = cos(loc.lat());
+   bool in = crosses(loc, r, lat, lon, 0, count - 1);
+
+   const __m256d scale = _mm256_set1_pd(elnet_scale);
+   const __m256d vr = _mm256_set1_pd(r);
+   const __m256d y = _mm256_set1_pd(loc.lat());
+   const __m256d x = _mm256_set1_pd(loc.lon()*r);
+   int hits = 0;
+   uint32_t a = 1;
+   for (; a + 4 <= count; a += 4) {
+      const __m256d lat_a = _mm256_mul_pd(_mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lat + a))), scale);
+      const __m256d lat_b = _mm256_mul_pd(_mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lat + a - 1))), scale);
+      const __m256d lon_a = _mm256_mul_pd(_mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lon + a))), scale);
+      const __m256d lon_b = _mm256_mul_pd(_mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lon + a - 1))), scale);
+      const __m256d within = _mm256_xor_pd(_mm256_cmp_pd(lat_a, y, _CMP_GT_OQ), _mm256_cmp_pd(lat_b, y, _CMP_GT_OQ));
+      if (!_mm256_movemask_pd(within)) continue; // Most edges are not level with loc
+      const __m256d lon_ar = _mm256_mul_pd(lon_a, vr);
+      const __m256d edge = _mm256_add_pd(_mm256_div_pd(_mm256_mul_pd(_mm256_sub_pd(_mm256_mul_pd(lon_b, vr), lon_ar), _mm256_sub_pd(y, lat_a)), _mm256_sub_pd(lat_b, lat_a)), lon_ar);
+      hits += __builtin_popcount(_mm256_movemask_pd(_mm256_and_pd(within, _mm256_cmp_pd(x, edge, _CMP_LT_OQ))));
+   }
+   for (; a < count; ++a) {
+      if (crosses(loc, r, lat, lon, a, a - 1)) in = !in;
+   }
+   return in != (hits & 1);
+}
+#endif
+
+using in_poly_func = bool (*)(const location& loc, const int32_t *lat, const int32_t *lon, uint32_t count);
+
+in_poly_func select_in_poly()
+{
+#if defined(__x86_64__)
+   if (__builtin_cpu_supports("avx")) return in_poly_avx;
+   return in_poly_sse2;
+#else
+   return in_poly_scalar;
+#endif
+}
+
+// Kernel of all elnet lookups. Set when the boundaries are loaded, or by set_elnet_kernel().
+in_poly_func in_poly = nullptr;
+
+// Elnet boundaries read directly from the packed layout. A grid over the boundaries
+// lists the features which may contain a point in each cell.
+class elnet_map
+{
+   public:
+   elnet_map(const void *data, size_t size);
+   const elnet_feature *find(const location &loc) const;
+   void find(const std::vector<location> &locs, std::vector<const elnet_feature*> &found) const;
+   std::string name(const elnet_feature &f) const { return std::string(m_names + f.name_offset, f.name_size); }
+
+   protected:
+   const elnet_header *m_header;
+   const elnet_feature *m_features;
+   const elnet_ring *m_rings;
+   const int32_t *m_lat;
+   const int32_t *m_lon;
+   const uint32_t *m_cell_first;       // Cell i's features are m_cell_features[m_cell_first[i]] - [m_cell_first[i+1]]
+   const uint32_t *m_cell_features;
+   const char *m_names;
+
+   // Must match cell() in elnet-pack.py
+   int cell(int32_t v, int32_t lo, int32_t hi) const
+   {
+      const int64_t grid = m_header->grid_size;
+      return std::min<int64_t>(grid - 1, std::max<int64_t>(0, (int64_t(v) - lo) * grid / (int64_t(hi) - lo)));
+   }
+   bool locate(const location &loc, int32_t &lat, int32_t &lon, int &cell) const;
+   bool in_ring(const location &loc, int32_t lat, int32_t lon, const elnet_ring &ring) const;
+};
+
+elnet_map::elnet_map(const void *data, size_t size)
+{
+   if (!in_poly) in_poly = select_in_poly();
+
+   const char *p = static_cast<const char*>(data);
+   m_header = reinterpret_cast<const elnet_header*>(p);
+   if (size < sizeof(elnet_header) || memcmp(m_header->magic, "TCEN", 4) != 0) throw std::runtime_error("Unexpected elnet format");
+   if (m_header->version != elnet_version) throw std::runtime_error("Unexpected elnet version " + std::to_string(m_header->version));
+
+   const elnet_header &h = *m_header;
+   const uint64_t cells = uint64_t(h.grid_size) * h.grid_size;
+   const uint64_t expected = sizeof(elnet_header) + uint64_t(h.feature_count) * sizeof(elnet_feature) + uint64_t(h.ring_count) * sizeof(elnet_ring)
+      + uint64_t(h.coord_count) * 2 * sizeof(int32_t) + (cells + 1 + h.cell_feature_count) * sizeof(uint32_t) + h.names_size;
+   if (h.grid_size == 0 || h.grid_size > 1024 || expected != size) throw std::runtime_error("Unexpected elnet size");
+   if (h.box.lat_min >= h.box.lat_max || h.box.lon_min >= h.box.lon_max) throw std::runtime_error("Unexpected elnet bbox");
+
+   p += sizeof(elnet_header);
+   m_features = reinterpret_cast<const elnet_feature*>(p);
+   p += h.feature_count * sizeof(elnet_feature);
+   m_rings = reinterpret_cast<const elnet_ring*>(p);
+   p += h.ring_count * sizeof(elnet_ring);
+   m_lat = reinterpret_cast<const int32_t*>(p);
+   p += h.coord_count * sizeof(int32_t);
+   m_lon = reinterpret_cast<const int32_t*>(p);
+   p += h.coord_count * sizeof(int32_t);
+   m_cell_first = reinterpret_cast<const uint32_t*>(p);
+   p += (cells + 1) * sizeof(uint32_t);
+   m_cell_features = reinterpret_cast<const uint32_t*>(p);
+   p += h.cell_feature_count * sizeof(uint32_t);
+   m_names = p;
+
+   // Check all offsets once, so lookups can trust them
+   for (uint32_t i = 0; i < h.feature_count; ++i) {
+      const elnet_feature &f = m_features[i];
+      if (uint64_t(f.first_ring) + f.ring_count > h.ring_count) throw std::runtime_error("Unexpected elnet ring index");
+      if (uint64_t(f.name_offset) + f.name_size > h.names_size) throw std::runtime_error("Unexpected elnet name");
+   }
+   for (uint32_t i = 0; i < h.ring_count; ++i) {
+      const elnet_ring &r = m_rings[i];
+      if (r.count == 0 || uint64_t(r.first) + r.count > h.coord_count) throw std::runtime_error("Unexpected elnet coordinate index");
+   }
+   if (m_cell_first[0] != 0 || m_cell_first[cells] != h.cell_feature_count) throw std::runtime_error("Unexpected elnet grid");
+   for (uint64_t i = 0; i < cells; ++i) {
+      if (m_cell_first[i] > m_cell_first[i + 1]) throw std::runtime_error("Unexpected elnet grid");
+   }
+   for (uint32_t i = 0; i < h.cell_feature_count; ++i) {
+      if (m_cell_features[i] >= h.feature_count) throw std::runtime_error("Unexpected elnet grid");
+   }
+}
+
+bool elnet_map::in_ring(const location &loc, int32_t lat, int32_t lon, const elnet_ring &ring) const
+{
+   // A point outside the bounding box crosses the ring an even number of times
+   return ring.box.contains(lat, lon) && in_poly(loc, m_lat + ring.first, m_lon + ring.first, ring.count);
+}
+
+// Coordinate units and grid cell of loc. False if loc is outside the boundaries.
+bool elnet_map::locate(const location &loc, int32_t &lat, int32_t &lon, int &c) const
+{
+   if (!(std::fabs(loc.lat()) <= 90 && std::fabs(loc.lon()) <= 180)) return false;
+   lat = std::lround(loc.lat() / elnet_scale);
+   lon = std::lround(loc.lon() / elnet_scale);
+   const elnet_bbox &box = m_header->box;
+   if (!box.contains(lat, lon)) return false;
+
+   c = cell(lat, box.lat_min, box.lat_max) * m_header->grid_size + cell(lon, box.lon_min, box.lon_max);
+   return true;
+}
+
+const elnet_feature *elnet_map::find(const location &loc) const
+{
+   int32_t lat, lon;
+   int c;
+   if (!locate(loc, lat, lon, c)) return nullptr;
+
+   for (uint32_t i = m_cell_first[c]; i < m_cell_first[c + 1]; ++i) {
+      const elnet_feature &f = m_features[m_cell_features[i]];
+      if (!f.box.contains(lat, lon)) continue;
+      const elnet_ring *ring = m_rings + f.first_ring;
+      const elnet_ring *end = ring + f.ring_count;
+      if (!f.multi) {
+         for (; ring != end; ++ring) {
+            if (in_ring(loc, lat, lon, *ring)) return &f;
          }
       }
-      else if (type.GetString() == std::string("MultiPolygon")) {
-         for (auto& m : coordinates.GetArray()) {
+      else {
+         while (ring != end) {
+            // toggle found. Multiple matches means loc is in a "hole" polygon inside a bigger polygon
             bool found = false;
-            for (auto& p : m.GetArray()) {
-               polygon poly;
-               for (auto& c : p.GetArray()) poly.emplace_back(c[1].GetDouble(), c[0].GetDouble());
-               auto in = in_poly(loc, poly);
-               if (in) {
-                  found = !found; // toggle found. Multiple matches means loc is in a "hole" polygon inside a bigger polygon
-                  //std::cout << "match: " << dist << std::endl;
-               }
+            const uint32_t part = ring->part;
+            for (; ring != end && ring->part == part; ++ring) {
+               if (in_ring(loc, lat, lon, *ring)) found = !found;
             }
-            if (found) {
-               //std::cout << "found." << std::endl;
-               return navn.GetString();
+            if (found) return &f;
+         }
+      }
+   }
+   return nullptr;
+}
+
+// Same as find() for each of locs. Instead of testing all edges of a ring for each point, each edge
+// is tested only against the points level with it. Points are sorted by latitude, so those are found by
+// a binary search. Equal points, as when the car is parked, are tested once.
+void elnet_map::find(const std::vector<location> &locs, std::vector<const elnet_feature*> &found) const
+{
+   found.assign(locs.size(), nullptr);
+
+   struct point
+   {
+      location loc;
+      double r;         // As in in_poly_scalar()
+      int32_t lat;
+      int32_t lon;
+      uint32_t index;   // In locs
+      bool same;        // Equal to the point before, which is tested instead
+      const elnet_feature *found;
+   };
+   std::vector<point> points;
+   points.reserve(locs.size());
+   for (uint32_t i = 0; i < locs.size(); ++i) {
+      point p { locs[i], cos(locs[i].lat()), 0, 0, i, false, nullptr };
+      int c;
+      if (locate(locs[i], p.lat, p.lon, c)) points.push_back(p);
+   }
+   std::sort(points.begin(), points.end(), [](const point &a, const point &b) {
+      return a.loc.lat() != b.loc.lat() ? a.loc.lat() < b.loc.lat() : a.loc.lon() < b.loc.lon();
+   });
+   for (size_t i = 1; i < points.size(); ++i) {
+      points[i].same = points[i - 1].loc.lat() == points[i].loc.lat() && points[i - 1].loc.lon() == points[i].loc.lon();
+   }
+
+   // Points of the current feature, in latitude order. If each is in the feature, and in the part it
+   // was last crossed in. A part is added to in when the point is crossed in the next one, so only the
+   // points level with an edge are touched for each ring.
+   std::vector<point*> tested;
+   std::vector<double> lat;
+   std::vector<char> in, in_part;
+   std::vector<uint32_t> part;
+
+   // A point in several features gets the first, as with find(). The cells list features in file order.
+   for (uint32_t i = 0; i < m_header->feature_count; ++i) {
+      const elnet_feature &f = m_features[i];
+      tested.clear();
+      lat.clear();
+      auto p = std::partition_point(points.begin(), points.end(), [&f](const point &p) { return p.lat < f.box.lat_min; });
+      for (; p != points.end() && p->lat <= f.box.lat_max; ++p) {
+         if (p->same || p->found || !f.box.contains(p->lat, p->lon)) continue;
+         tested.push_back(&*p);
+         lat.push_back(p->loc.lat());
+      }
+      if (tested.empty()) continue;
+      in.assign(tested.size(), false);
+      in_part.assign(tested.size(), false);
+      part.assign(tested.size(), 0);
+
+      // Each ring of a polygon is a match of its own. Rings of a part of a multipolygon toggle,
+      // as a ring inside another is a hole.
+      const elnet_ring *first = m_rings + f.first_ring;
+      const elnet_ring *end = first + f.ring_count;
+      uint32_t current = 0;
+      for (const elnet_ring *ring = first; ring != end; ++ring) {
+         if (!f.multi || ring == first || ring->part != (ring - 1)->part) ++current;
+         const int32_t *ring_lat = m_lat + ring->first;
+         const int32_t *ring_lon = m_lon + ring->first;
+         for (uint32_t a = 0, b = ring->count - 1; a < ring->count; b = a++) {
+            // Level with the edge as in crosses(): lat_lo <= lat < lat_hi
+            const double lat_a = ring_lat[a] * elnet_scale, lat_b = ring_lat[b] * elnet_scale;
+            const auto lo = std::lower_bound(lat.begin(), lat.end(), std::min(lat_a, lat_b));
+            const auto hi = std::lower_bound(lo, lat.end(), std::max(lat_a, lat_b));
+            for (size_t t = lo - lat.begin(); t < size_t(hi - lat.begin()); ++t) {
+               const point &p = *tested[t];
+               if (in[t] || !ring->box.contains(p.lat, p.lon)) continue; // As in in_ring()
+               if (!crosses(p.loc, p.r, ring_lat, ring_lon, a, b)) continue;
+               if (part[t] != current) {
+                  in[t] = in_part[t];
+                  in_part[t] = false;
+                  part[t] = current;
+                  if (in[t]) continue;
+               }
+               in_part[t] = !in_part[t];
             }
          }
       }
-      else throw std::runtime_error(std::string("Unexpeted elnet coordinates format ") + type.GetString());
+      for (size_t t = 0; t < tested.size(); ++t) {
+         if (in[t] || in_part[t]) tested[t]->found = &f;
+      }
+   }
+
+   for (size_t i = 0; i < points.size(); ++i) {
+      if (points[i].same) points[i].found = points[i - 1].found;
+      found[points[i].index] = points[i].found;
    }
-   
-   return found_name;
 }
 
+// Use a boundary file on disk if there is one, so boundaries can be updated without a rebuild.
+// The mapping is kept for the lifetime of the process.
+elnet_map load_elnet()
+{
+   const int fd = open(elnet_file, O_RDONLY);
+   if (fd >= 0) {
+      struct stat st;
+      void *data = MAP_FAILED;
+      if (fstat(fd, &st) == 0 && st.st_size > 0) data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      close(fd);
+      if (data != MAP_FAILED) {
+         try {
+            return elnet_map(data, st.st_size);
+         }
+         catch (const std::exception &e) {
+            log_line() << "Error: " << elnet_file << ": " << e.what() << ". Using built in elnet boundaries";
+            munmap(data, st.st_size);
+         }
+      }
+   }
+   return elnet_map(elnet_bin(), elnet_bin_len());
+}
+
+const elnet_map& elnet()
+{
+   static const elnet_map map = load_elnet();
+   return map;
+}
+
+}
+
+std::string get_elnet(location loc)
+{
+   const elnet_map &map = elnet();
+   const elnet_feature *f = map.find(loc);
+   return f ? map.name(*f) : std::string();
+}
+
+std::vector<std::string> get_elnet(const std::vector<location> &locs)
+{
+   const elnet_map &map = elnet();
+   std::vector<const elnet_feature*> found;
+   map.find(locs, found);
+   std::vector<std::string> names;
+   names.reserve(locs.size());
+   for (auto f : found) names.push_back(f ? map.name(*f) : std::string());
+   return names;
+}
+
+bool set_elnet_kernel(elnet_kernel kernel)
+{
+   elnet(); // Loaded first, as loading selects the kernel
+   switch (kernel) {
+      case elnet_kernel::scalar:
+         in_poly = in_poly_scalar;
+         return true;
+#if defined(__x86_64__)
+      case elnet_kernel::sse2:
+         in_poly = in_poly_sse2;
+         return true;
+      case elnet_kernel::avx:
+         if (!__builtin_cpu_supports("avx")) return false;
+         in_poly = in_poly_avx;
+         return true;
+#endif
+      default:
+         return false;
+   }
+}
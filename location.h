@@ -42,6 +42,12 @@ using polygon = std::vector<location>;
 
 double distance(const location& a, const location& b);
 std::string get_elnet(location loc);
+std::vector<std::string> get_elnet(const std::vector<location> &locs); // Many locations at once, e.g. for drive history
+
+// Point in polygon kernel of the elnet lookups. By default the fastest the CPU supports. The others
+// are for comparing results and timing. Not thread safe, set it before lookups. False if not supported.
+enum class elnet_kernel { scalar, sse2, avx };
+bool set_elnet_kernel(elnet_kernel kernel);
 
 #endif
 
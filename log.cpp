@@ -0,0 +1,53 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "log.h"
+
+#include <mutex>
+
+namespace {
+
+std::mutex log_mutex;
+thread_local log_scope *thread_scope = nullptr;
+
+}
+
+log_scope::log_scope() : m_outer(thread_scope)
+{
+	thread_scope = this;
+}
+
+log_scope::~log_scope()
+{
+	thread_scope = m_outer;
+	std::lock_guard<std::mutex> lock(log_mutex);
+	std::cout << str() << std::flush;
+	std::cerr << m_err.str() << std::flush;
+}
+
+log_line::~log_line()
+{
+	*this << '\n';
+	if (thread_scope) {
+		(&m_os == &std::cerr ? thread_scope->m_err : *thread_scope) << str();
+		return;
+	}
+	std::lock_guard<std::mutex> lock(log_mutex);
+	m_os << str() << std::flush;
+}
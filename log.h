@@ -0,0 +1,57 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#ifndef __LOG_H
+#define __LOG_H
+
+#include <iostream>
+#include <sstream>
+
+// Output of one car. Lines logged on the thread while it exists are kept, and written in one piece
+// when it ends, also on errors. So cars processed in parallel don't interleave their output.
+class log_scope : public std::ostringstream
+{
+	public:
+	log_scope();
+	~log_scope();
+
+	log_scope(const log_scope&) = delete;
+	log_scope &operator=(const log_scope&) = delete;
+
+	protected:
+	friend class log_line;
+
+	log_scope *m_outer;
+	std::ostringstream m_err;   // Lines for std::cerr
+};
+
+// One line for os, std::cout or std::cerr, written when the object ends. Goes to the log_scope of
+// the thread if there is one. Otherwise the whole line is written at once.
+// Use as a temporary: log_line(std::cerr) << "Error: " << e.what();
+class log_line : public std::ostringstream
+{
+	public:
+	explicit log_line(std::ostream &os = std::cout) : m_os(os) {}
+	~log_line();
+
+	protected:
+	std::ostream &m_os;
+};
+
+#endif
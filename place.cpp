@@ -0,0 +1,150 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+ 
+#include "place.h"
+#include "log.h"
+#include "record_store_impl.h"
+#include "ReverseGeocode.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+
+namespace {
+
+constexpr double place_quantum = 1e-3;                       // degrees. About 100m, so a parked car stays in one cell
+constexpr std::chrono::hours place_recheck { 30 * 24 };     // Look up again now and then, as boundaries may be updated
+constexpr size_t place_max = 1000;
+
+std::mutex place_mutex;
+
+// Zero filled, and cut at a whole utf-8 character. Returns false if s was cut.
+template<size_t N>
+bool set_field(char (&field)[N], const std::string &s)
+{
+	size_t len = std::min(s.size(), N - 1);
+	if (len < s.size()) {
+		while (len > 0 && (static_cast<unsigned char>(s[len]) & 0xc0) == 0x80) --len;
+	}
+	memset(field, 0, N);
+	memcpy(field, s.data(), len);
+	return len == s.size();
+}
+
+template<size_t N>
+std::string get_field(const char (&field)[N])
+{
+	return std::string(field, strnlen(field, N));
+}
+
+}
+
+std::string get_area(const std::string& country, const location& loc)
+{
+	struct location_entry
+	{
+		location loc;
+		std::string country;
+		std::string area;
+	} location_map[] = {
+		{{55.306978, 10.805645}, "DK", "DK1"},  // Nyborg
+		{{55.357423, 11.117698}, "DK", "DK2"},  // Halsskov
+
+		{{57.398749, 14.682311}, "SE", "SE3"},  // Approximation. Where is the exact SE3/SE4 zone?
+		{{57.391515, 14.680349}, "SE", "SE4"},  // Approximation. Where is the exact SE3/SE4 zone?
+
+		{{00.000000, 00.000000}, "NO", "NO2"},  // Only one zone for norway?
+	};
+
+	location_entry found = location_map[0];
+	for (auto& l : location_map) {
+                if (l.country != country) continue;
+		if (found.area.empty() || distance(loc, l.loc) < distance(loc, found.loc)) {
+			found = l;
+		}
+	}
+	return found.area;
+}
+
+place_info get_place(const location& loc)
+{
+	if (!std::isfinite(loc.lat()) || !std::isfinite(loc.lon())) throw std::runtime_error("No location found");
+	const int32_t lat = std::lround(loc.lat() / place_quantum);
+	const int32_t lon = std::lround(loc.lon() / place_quantum);
+	const auto now = std::chrono::system_clock::now();
+
+	static record_store<place_record> cache("place-cache");
+	static bool loaded = false;
+	{
+		std::lock_guard<std::mutex> lock(place_mutex);
+		if (!loaded) {
+			cache.load();
+			loaded = true;
+		}
+
+		auto cached = std::find_if(cache.rows.begin(), cache.rows.end(), [lat, lon](const place_record &r) { return r.lat == lat && r.lon == lon; });
+		if (cached != cache.rows.end() && now - std::chrono::system_clock::time_point(std::chrono::seconds(cached->checked)) < place_recheck) {
+			return { get_field(cached->country), get_field(cached->name), get_field(cached->area), get_field(cached->elnet) };
+		}
+	}
+
+	// Not locked while looking up, so cars at other places don't wait for it
+	auto geoloc = ReverseGeocode::instance().search(loc.lat(), loc.lon());
+	if (geoloc.size() != 1) throw std::runtime_error("No location found");
+	place_info p;
+	p.country = geoloc[0]["cc"];
+	p.name = geoloc[0]["name"];
+	p.area = get_area(p.country, loc);
+	p.elnet = get_elnet(loc);
+
+	place_record r;
+	r.lat = lat;
+	r.lon = lon;
+	r.checked = std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count();
+	set_field(r.name, p.name); // Only shown, so it may be cut
+
+	// A cut country, area or elnet would give wrong prices when read from the cache
+	const bool fits = set_field(r.country, p.country) && set_field(r.area, p.area) && set_field(r.elnet, p.elnet);
+	if (!fits) {
+		log_line(std::cerr) << "Error: Place " << p.country << '/' << p.area << ' ' << p.elnet << " too long for the place cache";
+		return p;
+	}
+
+	std::lock_guard<std::mutex> lock(place_mutex);
+	// Look for the cell again. Another car may have added it meanwhile.
+	auto cached = std::find_if(cache.rows.begin(), cache.rows.end(), [lat, lon](const place_record &c) { return c.lat == lat && c.lon == lon; });
+	if (cached != cache.rows.end()) *cached = r;
+	else cache.rows.push_back(r);
+	if (cache.rows.size() > place_max) {
+		cache.rows.erase(std::min_element(cache.rows.begin(), cache.rows.end(), [](const place_record &a, const place_record &b) { return a.checked < b.checked; }));
+	}
+
+	cache.updated = now;
+	try {
+		cache.save();
+	}
+	catch (std::exception &e) {
+		log_line(std::cerr) << "Error: " << e.what();
+	}
+	return p;
+}
@@ -0,0 +1,57 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+
+#ifndef __PLACE_H
+#define __PLACE_H
+
+#include "location.h"
+
+#include <string>
+#include <cstdint>
+
+struct place_info
+{
+	std::string country;
+	std::string name;
+	std::string area;    // El price area, eg. DK1
+	std::string elnet;
+};
+
+constexpr size_t elnet_name_max = 47; // bytes. Longest elnet name, must match name_max in elnet-pack.py
+
+// Stored lookup in the place cache. Location is in units of place_quantum.
+struct place_record
+{
+	int32_t lat;
+	int32_t lon;
+	int64_t checked;     // seconds since epoch
+	char country[4];
+	char area[12];
+	char elnet[elnet_name_max + 1];
+	char name[64];
+};
+
+std::string get_area(const std::string& country, const location& loc);
+
+// Country, area and elnet of a location. Lookups are cached in /var/tmp/tesla-cron by rounded
+// location, so a parked car needs no lookup.
+place_info get_place(const location& loc);
+
+#endif
@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+#*************************************************************************
+#** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+#**
+#** This file is part of tesla-cron.
+#**
+#** tesla-cron is free software: you can redistribute it and/or modify
+#** it under the terms of the GNU General Public License as published by
+#** the Free Software Foundation, either version 3 of the License, or
+#** (at your option) any later version.
+#**
+#** tesla-cron is distributed in the hope that it will be useful,
+#** but WITHOUT ANY WARRANTY; without even the implied warranty of
+#** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+#** GNU General Public License for more details.
+#**
+#** You should have received a copy of the GNU General Public License
+#** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+#*************************************************************************/
+
+# Packs the places of the reverse_geocoder package (rg_cities1000.csv) into the
+# binary layout read by ReverseGeocode.cpp.
+# usage: places-pack.py <rg_cities1000.csv> <out.bin>
+#
+# All values are little endian.
+#
+#  header  magic "TCPL", version, place_count, text_size
+#  place   float x, y, z (earth centered coordinates in km), int32 lat, lon
+#          (1e-7 degrees), text offset, cc[2], reserved[2]
+#  text    name, admin1 and admin2 of each place, each terminated by \0
+#
+# The places form an implicit k-d tree: the place at the middle of a range
+# [lo, hi) splits it on axis x, y, z by depth, with the range below holding the
+# smaller and the range above the larger coordinates.
+
+import csv
+import math
+import struct
+import sys
+
+version = 1
+
+# WGS84, as used by reverse_geocoder
+A = 6378.137
+E2 = 0.00669437999014
+
+def ecef(lat, lon):
+    lat = math.radians(lat)
+    lon = math.radians(lon)
+    normal = A / math.sqrt(1 - E2 * math.sin(lat) ** 2)
+    return (normal * math.cos(lat) * math.cos(lon),
+            normal * math.cos(lat) * math.sin(lon),
+            normal * (1 - E2) * math.sin(lat))
+
+def build(places, out):
+    # Iterative to keep Python's recursion limit out of it
+    stack = [(places, 0, len(places), 0)]
+    while stack:
+        items, lo, hi, depth = stack.pop()
+        if lo >= hi:
+            continue
+        axis = depth % 3
+        items.sort(key=lambda p: p[0][axis])
+        mid = (hi - lo) // 2
+        out[lo + mid] = items[mid]
+        stack.append((items[:mid], lo, lo + mid, depth + 1))
+        stack.append((items[mid + 1:], lo + mid + 1, hi, depth + 1))
+
+def main(src, dst):
+    places = []
+    with open(src, encoding='utf-8', newline='') as f:
+        for row in csv.DictReader(f):
+            lat = float(row['lat'])
+            lon = float(row['lon'])
+            cc = row['cc'].encode('ascii')
+            if len(cc) > 2:
+                raise ValueError('Unexpected country code ' + row['cc'])
+            places.append((ecef(lat, lon), lat, lon, row['name'], row['admin1'], row['admin2'], cc))
+
+    tree = [None] * len(places)
+    build(places, tree)
+
+    records = bytearray()
+    text = bytearray()
+    for (x, y, z), lat, lon, name, admin1, admin2, cc in tree:
+        records += struct.pack('<3f2iI2s2x', x, y, z, int(round(lat * 10000000)), int(round(lon * 10000000)), len(text), cc)
+        for s in (name, admin1, admin2):
+            text += s.encode('utf-8') + b'\0'
+
+    with open(dst, 'wb') as f:
+        f.write(b'TCPL')
+        f.write(struct.pack('<3I', version, len(tree), len(text)))
+        f.write(records)
+        f.write(text)
+
+if __name__ == '__main__':
+    if len(sys.argv) != 3:
+        sys.exit('usage: places-pack.py <rg_cities1000.csv> <out.bin>')
+    main(sys.argv[1], sys.argv[2])
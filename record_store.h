@@ -0,0 +1,49 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#ifndef __RECORD_STORE_H
+#define __RECORD_STORE_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cmath>
+
+// Persistent store of fixed size records in /var/tmp/tesla-cron, eg downloaded prices, so each
+// run only needs to download what is new. The file is a small header followed by the raw rows.
+// The members are defined in record_store_impl.h, and instantiated next to each record type.
+template<class row>
+class record_store
+{
+	public:
+	explicit record_store(const std::string &name);
+
+	void load();        // A missing or invalid file loads as an empty store
+	void save() const;
+
+	std::vector<row> rows;
+	std::chrono::time_point<std::chrono::system_clock> updated;  // Time of last download
+	float value { NAN };                                          // Store specific, eg dk/eur rate for spot prices
+
+	protected:
+	std::string m_file;
+};
+
+#endif
+
@@ -0,0 +1,99 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+ 
+#ifndef __RECORD_STORE_IMPL_H
+#define __RECORD_STORE_IMPL_H
+
+// Members of record_store. Only included where a store is instantiated for a record type.
+#include "record_store.h"
+#include "atomic_file.h"
+
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+namespace record_store_file {
+
+inline const std::string store_path = "/var/tmp/tesla-cron";
+
+inline const char store_magic[4] = { 'T', 'C', 'P', 'S' };
+inline const uint32_t store_version = 1;
+
+struct store_header
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t row_size;
+	uint32_t count;
+	int64_t updated;     // seconds since epoch
+	float value;
+	uint32_t reserved;
+};
+
+}
+
+template<class row>
+record_store<row>::record_store(const std::string &name) : m_file(record_store_file::store_path + "/" + name + ".bin")
+{
+	static_assert(std::is_trivially_copyable<row>::value, "record_store rows are stored as raw bytes");
+}
+
+template<class row>
+void record_store<row>::load()
+{
+	rows.clear();
+	updated = {};
+	value = NAN;
+
+	std::ifstream is(m_file, std::ios::binary);
+	if (!is) return;
+
+	record_store_file::store_header h;
+	if (!is.read(reinterpret_cast<char*>(&h), sizeof(h))) return;
+	if (memcmp(h.magic, record_store_file::store_magic, sizeof(record_store_file::store_magic)) != 0) return;
+	if (h.version != record_store_file::store_version || h.row_size != sizeof(row)) return;
+
+	std::vector<row> r(h.count);
+	if (!is.read(reinterpret_cast<char*>(r.data()), h.count * sizeof(row))) return;
+
+	rows = std::move(r);
+	updated = std::chrono::time_point<std::chrono::system_clock>(std::chrono::seconds(h.updated));
+	value = h.value;
+}
+
+template<class row>
+void record_store<row>::save() const
+{
+	record_store_file::store_header h {};
+	memcpy(h.magic, record_store_file::store_magic, sizeof(record_store_file::store_magic));
+	h.version = record_store_file::store_version;
+	h.row_size = sizeof(row);
+	h.count = rows.size();
+	h.updated = std::chrono::duration_cast<std::chrono::seconds>(updated.time_since_epoch()).count();
+	h.value = value;
+
+	std::string bytes(reinterpret_cast<const char*>(&h), sizeof(h));
+	bytes.append(reinterpret_cast<const char*>(rows.data()), rows.size() * sizeof(row));
+	atomic_write_file(m_file, bytes);
+}
+
+#endif
+
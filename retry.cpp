@@ -0,0 +1,94 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+ 
+#include "retry.h"
+
+#include <random>
+#include <thread>
+#include <algorithm>
+
+namespace {
+
+// Per thread, as cars processed in parallel have their own deadlines
+thread_local std::chrono::time_point<std::chrono::system_clock> thread_deadline { std::chrono::time_point<std::chrono::system_clock>::max() };
+
+}
+
+namespace {
+
+// Host part of url. Paths may hold private keys, eg private calendar addresses, so keep those out of the log.
+std::string url_host(const std::string &url)
+{
+	auto begin = url.find("://");
+	begin = begin == std::string::npos ? 0 : begin + 3;
+	return url.substr(0, url.find('/', begin));
+}
+
+}
+
+http_error::http_error(long status, const std::string &url) : std::runtime_error("Http status " + std::to_string(status) + " from " + url_host(url)), m_status(status),
+	m_vehicle(url.find("/api/1/vehicles/") != std::string::npos)
+{
+}
+
+bool http_error::retryable() const
+{
+	// The Tesla API answers 408 when the car is asleep or offline. It stays that way until the car is woken up.
+	if (m_status == 408 && m_vehicle) return false;
+
+	// Timeout, too early, rate limited or server errors. Other 4xx are client errors which retrying won't fix.
+	return m_status == 408 || m_status == 425 || m_status == 429 || m_status >= 500;
+}
+
+void set_retry_deadline(std::chrono::time_point<std::chrono::system_clock> deadline)
+{
+	thread_deadline = deadline;
+}
+
+std::chrono::time_point<std::chrono::system_clock> retry_deadline()
+{
+	return thread_deadline;
+}
+
+bool retryable(const std::exception &e)
+{
+	if (dynamic_cast<const fatal_error*>(&e)) return false;
+	if (auto h = dynamic_cast<const http_error*>(&e)) return h->retryable();
+	return true;
+}
+
+bool retry_wait(const retry_policy &policy, int attempt)
+{
+	using namespace std::chrono;
+
+	thread_local std::mt19937 rng { std::random_device()() };
+
+	auto limit = policy.base_delay;
+	for (int i = 1; i < attempt && limit < policy.max_delay; ++i) limit *= 2;
+	limit = std::min(limit, policy.max_delay);
+	const milliseconds delay { std::uniform_int_distribution<milliseconds::rep>(limit.count() / 2, limit.count())(rng) };
+
+	if (system_clock::now() + delay > thread_deadline) {
+		log_line(std::cerr) << "Error: No time left for retry";
+		return false;
+	}
+	std::this_thread::sleep_for(delay);
+	return true;
+}
+
@@ -0,0 +1,94 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#ifndef __RETRY_H
+#define __RETRY_H
+
+#include "log.h"
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+
+// Error from a request which will fail the same way if retried. Eg bad credentials.
+class fatal_error : public std::runtime_error
+{
+	public:
+	using std::runtime_error::runtime_error;
+};
+
+// Http request answered with an error status.
+class http_error : public std::runtime_error
+{
+	public:
+	http_error(long status, const std::string &url);
+	long status() const { return m_status; }
+	bool retryable() const;
+
+	protected:
+	long m_status;
+	bool m_vehicle;   // Request for a car of the Tesla API
+};
+
+struct retry_policy
+{
+	int attempts { 10 };
+	std::chrono::milliseconds base_delay { std::chrono::seconds(5) };  // Delay after first attempt. Doubled for each attempt
+	std::chrono::milliseconds max_delay { std::chrono::minutes(2) };
+};
+
+// Deadline for all retries of this thread's run. A retry that would wait past it fails instead,
+// so a flaky server can't keep the run from finishing in time. Each thread has its own deadline.
+void set_retry_deadline(std::chrono::time_point<std::chrono::system_clock> deadline);
+std::chrono::time_point<std::chrono::system_clock> retry_deadline();
+
+// f with the retry deadline of the calling thread, to run f on another thread as part of the same run
+template<class F>
+auto with_retry_deadline(F f)
+{
+	return [f, deadline = retry_deadline()]() mutable {
+		set_retry_deadline(deadline);
+		return f();
+	};
+}
+
+// True if retrying may help. Network errors, timeouts, rate limits and server errors are retryable.
+bool retryable(const std::exception &e);
+
+// Wait before retry after 'attempt' failed attempts. Exponential backoff with jitter.
+// Returns false without waiting if the wait would pass the deadline.
+bool retry_wait(const retry_policy &policy, int attempt);
+
+// Call f until it succeeds. Rethrows if the error is not retryable, attempts run out or the deadline is reached.
+template<class F>
+auto retry(const retry_policy &policy, F f) -> decltype(f())
+{
+	for (int attempt = 1; ; ++attempt) {
+		try {
+			return f();
+		}
+		catch (std::exception &e) {
+			log_line(std::cerr) << "Error: " << e.what();
+			if (!retryable(e) || attempt >= policy.attempts || !retry_wait(policy, attempt)) throw;
+		}
+	}
+}
+
+#endif
+
@@ -0,0 +1,112 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+ 
+#include "scheduler.h"
+#include "log.h"
+
+#include <iostream>
+#include <exception>
+
+constexpr scheduler::clock::duration scheduler::tick;
+constexpr int64_t scheduler::slot_count;
+
+scheduler::scheduler(size_t workers) : m_tick(tick_of(clock::now())), m_slots(slot_count)
+{
+	for (size_t i = 0; i < workers; ++i) m_workers.emplace_back(&scheduler::work, this);
+}
+
+scheduler::~scheduler()
+{
+	stop();
+	for (auto &w : m_workers) w.join();
+}
+
+void scheduler::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_ready_cv.notify_all();
+	m_tick_cv.notify_all();
+}
+
+void scheduler::at(clock::time_point when, const std::string &key, task f)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto pending = m_keys.find(key);
+	if (pending != m_keys.end()) {
+		m_slots[pending->second.first].erase(pending->second.second);
+		m_keys.erase(pending);
+	}
+
+	// First tick at or after when, and never a tick that has already been handled
+	const int64_t due = std::max(tick_of(when - clock::duration(1)) + 1, m_tick + 1);
+	const int64_t slot = due % slot_count;
+	auto t = m_slots[slot].insert(m_slots[slot].end(), timer { due, key, std::move(f) });
+	m_keys.emplace(key, std::make_pair(slot, t));
+}
+
+void scheduler::run()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (!m_stop) {
+		// Handle all ticks since the last one. After a long pause one turn covers all slots.
+		const int64_t now = tick_of(clock::now());
+		bool ready = false;
+		for (int64_t n = std::max(m_tick + 1, now - slot_count + 1); n <= now; ++n) {
+			auto &slot = m_slots[n % slot_count];
+			for (auto t = slot.begin(); t != slot.end(); ) {
+				if (t->due > now) {
+					++t;
+					continue;
+				}
+				m_keys.erase(t->key);
+				m_ready.push_back(std::move(*t));
+				t = slot.erase(t);
+				ready = true;
+			}
+		}
+		m_tick = std::max(m_tick, now);
+		if (ready) m_ready_cv.notify_all();
+
+		m_tick_cv.wait_until(lock, clock::time_point(tick * (m_tick + 1)));
+	}
+}
+
+void scheduler::work()
+{
+	for (;;) {
+		timer t;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_ready_cv.wait(lock, [this]() { return m_stop || !m_ready.empty(); });
+			if (m_stop) return;
+			t = std::move(m_ready.front());
+			m_ready.pop_front();
+		}
+		try {
+			t.f();
+		}
+		catch (std::exception &e) {
+			log_line(std::cerr) << "Error: " << t.key << ": " << e.what();
+		}
+	}
+}
@@ -0,0 +1,88 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+
+#ifndef __SCHEDULER_H
+#define __SCHEDULER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Timer wheel for the daemon mode. Timers are kept in slots of one tick, and a slot is checked
+// when its tick is reached. Timers further ahead than one turn of the wheel stay in their slot
+// for the following turns. Due tasks are run by a fixed set of worker threads, so per thread
+// state like the http handles stays warm between runs.
+class scheduler
+{
+	public:
+	using clock = std::chrono::system_clock;
+	using task = std::function<void()>;
+
+	explicit scheduler(size_t workers);
+	~scheduler();
+
+	// Run f at when, or at the first tick after. A pending timer with the same key is replaced.
+	// May be called from a running task.
+	void at(clock::time_point when, const std::string &key, task f);
+
+	// Wait for ticks and hand due tasks to the workers. Returns after stop().
+	void run();
+
+	// Make run() return, and the workers stop after their current task. Pending timers are dropped.
+	// May be called from a running task.
+	void stop();
+
+	scheduler(const scheduler&) = delete;
+	scheduler &operator=(const scheduler&) = delete;
+
+	protected:
+	static constexpr clock::duration tick = std::chrono::seconds(30);
+	static constexpr int64_t slot_count = 512;   // About 4h per turn
+
+	struct timer
+	{
+		int64_t due;   // tick number
+		std::string key;
+		task f;
+	};
+
+	static int64_t tick_of(clock::time_point t) { return t.time_since_epoch() / tick; }
+	void work();
+
+	std::mutex m_mutex;
+	std::condition_variable m_ready_cv;
+	std::condition_variable m_tick_cv;
+	bool m_stop { false };
+	int64_t m_tick;                            // Last tick handled
+	std::vector<std::list<timer>> m_slots;
+	std::map<std::string, std::pair<int64_t, std::list<timer>::iterator>> m_keys;   // Slot and timer of each pending key
+	std::deque<timer> m_ready;
+	std::vector<std::thread> m_workers;
+};
+
+#endif
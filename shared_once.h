@@ -0,0 +1,99 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#ifndef __SHARED_ONCE_H
+#define __SHARED_ONCE_H
+
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <map>
+#include <mutex>
+
+// Values made once per key and shared by all callers, eg prices that several cars need in the same
+// run. The first caller to get() a key makes the value, and concurrent callers for the same key wait
+// for it instead of making it again. Failures are not kept, so the next caller tries again.
+template<class K, class V>
+class shared_once
+{
+	public:
+	using time_point = std::chrono::time_point<std::chrono::system_clock>;
+
+	// Value of key, made by make() if there is none
+	template<class F>
+	V get(const K &key, F make)
+	{
+		std::shared_future<V> value;
+		uint64_t id;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto i = m_values.find(key);
+			if (i == m_values.end()) {
+				// Deferred: the first caller to get() makes it, others block until it is done
+				i = m_values.emplace(key, entry { std::async(std::launch::deferred, std::move(make)).share(), std::chrono::system_clock::now(), ++m_last_id }).first;
+			}
+			value = i->second.value;
+			id = i->second.id;
+		}
+
+		try {
+			return value.get();
+		}
+		catch (std::exception &) {
+			// The key may have been dropped and made again meanwhile. Only drop the failed one.
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto i = m_values.find(key);
+			if (i != m_values.end() && i->second.id == id) m_values.erase(i);
+			throw;
+		}
+	}
+
+	// Drop the value of key. Callers already waiting for it still get it.
+	void erase(const K &key)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_values.erase(key);
+	}
+
+	// Drop the values where drop(key, time made) is true. Callers already waiting for one still get it.
+	template<class P>
+	void erase_if(P drop)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (auto i = m_values.begin(); i != m_values.end(); ) {
+			if (drop(i->first, i->second.made)) i = m_values.erase(i);
+			else ++i;
+		}
+	}
+
+	protected:
+	struct entry
+	{
+		std::shared_future<V> value;
+		time_point made;
+		uint64_t id;
+	};
+
+	std::mutex m_mutex;
+	std::map<K, entry> m_values;
+	uint64_t m_last_id { 0 };
+};
+
+#endif
@@ -18,10 +18,11 @@
  *************************************************************************/
  
 #include "tesla-api.h"
+#include "http.h"
+#include "retry.h"
+#include "log.h"
 
 #include <curlpp/cURLpp.hpp>
-#include <curlpp/Options.hpp>
-#include <curlpp/Easy.hpp>
 #include <rapidjson/document.h>
 
 #include <sys/types.h>
@@ -74,294 +75,179 @@ namespace {
 		// Some form of response received
 		return true;
 	}
+
+	std::string departure_disable_body(std::chrono::minutes departure_m)
+	{
+		string body;
+		body += '{';
+		body += "\"enable\": false";
+		body += ", \"off_peak_charging_enabled\": false";
+		body += ", \"preconditioning_enabled\": false";
+		body += ", \"preconditioning_weekdays_only\": false";
+		body += ", \"off_peak_charging_weekdays_only\": false";
+		body += ", \"departure_time\": " + to_string(departure_m.count());
+		body += ", \"end_off_peak_time\": " + to_string(departure_m.count());
+		body += '}';
+		return body;
+	}
+
+	std::string charging_body(bool enable, std::chrono::minutes m)
+	{
+		string body;
+		body += '{';
+		body += "\"enable\": "; body += (enable ? "true" : "false");
+		body += ", \"time\": " + to_string(m.count());
+		body += '}';
+		return body;
+	}
 }
 
 void tesla_api::refresh_token()
 {
 	start_proxy();
 
-	int timeout = 10;
-	while (true) {
-		try {
-			ifstream is_refresh(refresh_token_file);
-			if (!is_refresh) throw runtime_error("Can't read refresh token");
-			string refresh_token;
-			is_refresh >> refresh_token;
-			is_refresh.close();
-
-			string url = "https://auth.tesla.com/oauth2/v3/token";
-			if (debug) cout << "url     :    " << url << endl;
-
-			curlpp::Cleanup clean;
-			curlpp::Easy r;
-			r.setOpt(new curlpp::options::Url(url));
-
-			list<string> headers;
-			headers.push_back("Content-Type: application/json");
-			r.setOpt(new curlpp::options::HttpHeader(headers));
-
-			string body;
-			body += '{';
-			body += "\"grant_type\": \"refresh_token\"";
-			body += ", \"client_id\": \"" + account.tesla_client_id + '"';
-			body += ", \"refresh_token\": \"" + refresh_token + '"';
-			body += '}';
-			r.setOpt(new curlpp::options::PostFields(body));
-			r.setOpt(new curlpp::options::PostFieldSize(body.length()));
-
-			ostringstream os_response;
-			r.setOpt(new curlpp::options::WriteStream(&os_response));
-
-			r.perform();
-			string response_data = os_response.str();
-			if (response_data.size() == 0) throw runtime_error("No reply from server");
-
-			if (debug) cout << "Response:    " << response_data << endl;
-
-			Document doc;
-			doc.Parse(response_data.c_str());
-			const Value &new_access_token = doc["access_token"];
-			if (!new_access_token.IsString()) throw runtime_error("Got no new access token");
-			const Value &new_refresh_token = doc["refresh_token"];
-			if (!new_refresh_token.IsString()) throw runtime_error("Got no new refresh token");
-
-			//cout << "New access:  " << new_access_token.GetString() << endl;
-			//cout << "New refresh: " << new_refresh_token.GetString() << endl;
-
-			ofstream os_access(access_token_file);
-			os_access << new_access_token.GetString();
-			if (!os_access) throw runtime_error("Could not write new access token");
-			ofstream os_refresh(refresh_token_file);
-			os_refresh << new_refresh_token.GetString();
-			if (!os_refresh) throw runtime_error("Could not write new refresh token");
-
-			// Ensure noone have read permission without write permission. Otherwise running tesla-cron as another user
-			// results in reading the refresh token, refreshing the token but unable to write the new token.
-			os_access.close();
-			os_refresh.close();
-			chmod(access_token_file.c_str(), S_IRUSR | S_IWUSR);
-			chmod(refresh_token_file.c_str(), S_IRUSR | S_IWUSR);
-
-			m_token = new_access_token.GetString();
-			break;
-		}
-		catch (std::exception &e) {
-			std::cerr << "Error: " << e.what() << std::endl;
-			if (--timeout == 0) throw;
-		}
-		std::this_thread::sleep_for(std::chrono::minutes(1));
-	}
+	retry(retry_policy(), [&]() {
+		ifstream is_refresh(refresh_token_file);
+		if (!is_refresh) throw fatal_error("Can't read refresh token");
+		string refresh_token;
+		is_refresh >> refresh_token;
+		is_refresh.close();
+
+		string url = "https://auth.tesla.com/oauth2/v3/token";
+		if (debug) log_line() << "url     :    " << url;
+
+		list<string> headers;
+		headers.push_back("Content-Type: application/json");
+
+		string body;
+		body += '{';
+		body += "\"grant_type\": \"refresh_token\"";
+		body += ", \"client_id\": \"" + account.tesla_client_id + '"';
+		body += ", \"refresh_token\": \"" + refresh_token + '"';
+		body += '}';
+
+		string response_data = http_session::instance().post(url, headers, body).body;
+		if (response_data.size() == 0) throw runtime_error("No reply from server");
+
+		if (debug) log_line() << "Response:    " << response_data;
+
+		Document doc;
+		doc.Parse(response_data.c_str());
+		const Value &new_access_token = doc["access_token"];
+		if (!new_access_token.IsString()) throw runtime_error("Got no new access token");
+		const Value &new_refresh_token = doc["refresh_token"];
+		if (!new_refresh_token.IsString()) throw runtime_error("Got no new refresh token");
+
+		//cout << "New access:  " << new_access_token.GetString() << endl;
+		//cout << "New refresh: " << new_refresh_token.GetString() << endl;
+
+		ofstream os_access(access_token_file);
+		os_access << new_access_token.GetString();
+		if (!os_access) throw runtime_error("Could not write new access token");
+		ofstream os_refresh(refresh_token_file);
+		os_refresh << new_refresh_token.GetString();
+		if (!os_refresh) throw runtime_error("Could not write new refresh token");
+
+		// Ensure noone have read permission without write permission. Otherwise running tesla-cron as another user
+		// results in reading the refresh token, refreshing the token but unable to write the new token.
+		os_access.close();
+		os_refresh.close();
+		chmod(access_token_file.c_str(), S_IRUSR | S_IWUSR);
+		chmod(refresh_token_file.c_str(), S_IRUSR | S_IWUSR);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_token = new_access_token.GetString();
+	});
 
 }
 
 bool tesla_api::available(string vin)
 {
-	int timeout = 10;
-	while (true) {
-		try {
-			string url = account.tesla_audience + "/api/1/vehicles/" + vin; 
-			if (debug) cout << "url     :    " << url << endl;
+	return retry(retry_policy(), [&]() {
+		string url = account.tesla_audience + "/api/1/vehicles/" + vin; 
+		if (debug) log_line() << "url     :    " << url;
 
-			curlpp::Cleanup clean;
-			curlpp::Easy r;
-			r.setOpt(new curlpp::options::Url(url));
+		list<string> headers;
+		headers.push_back("Content-Type: application/json");
+		headers.push_back("Authorization: Bearer " + token());
 
-			list<string> headers;
-			headers.push_back("Content-Type: application/json");
-			headers.push_back("Authorization: Bearer " + m_token);
-			r.setOpt(new curlpp::options::HttpHeader(headers));
+		string response_data = http_session::instance().get(url, headers).body;
+		if (response_data.size() == 0) throw runtime_error("No reply from server");
 
-			ostringstream os_response;
-			r.setOpt(new curlpp::options::WriteStream(&os_response));
+		if (debug) log_line() << "Response:    " << response_data;
 
-			r.perform();
-			string response_data = os_response.str();
-			if (response_data.size() == 0) throw runtime_error("No reply from server");
-
-			if (debug) cout << "Response:    " << response_data << endl;
-
-			Document doc;
-			doc.Parse(response_data.c_str());
-			const Value &response = doc["response"];
-			const Value &state = response["state"];
-			if (!state.IsString()) throw runtime_error("No vehicle state");
+		Document doc;
+		doc.Parse(response_data.c_str());
+		const Value &response = doc["response"];
+		const Value &state = response["state"];
+		if (!state.IsString()) throw runtime_error("No vehicle state");
 
-			return state.GetString() == string("online");
-		}
-		catch (std::exception &e) {
-			std::cerr << "Error: " << e.what() << std::endl;
-			if (--timeout == 0) throw;
-		}
-		std::this_thread::sleep_for(std::chrono::minutes(1));
-	}
-	return false;
+		return state.GetString() == string("online");
+	});
 }
 
 void tesla_api::wake_up(string vin)
 {
-	int timeout = 3;
-	while (true) {
-		try {
-			string url = account.tesla_audience + "/api/1/vehicles/" + vin + "/wake_up"; 
-			if (debug) cout << "url     :    " << url << endl;
-
-			curlpp::Cleanup clean;
-			curlpp::Easy r;
-			r.setOpt(new curlpp::options::Url(url));
-
-			list<string> headers;
-			headers.push_back("Content-Type: application/json");
-			headers.push_back("Authorization: Bearer " + m_token);
-			r.setOpt(new curlpp::options::HttpHeader(headers));
+	retry_policy policy;
+	policy.attempts = 3;
+	retry(policy, [&]() {
+		string url = account.tesla_audience + "/api/1/vehicles/" + vin + "/wake_up"; 
+		if (debug) log_line() << "url     :    " << url;
 
-			string body;
-			r.setOpt(new curlpp::options::PostFields(body));
-			r.setOpt(new curlpp::options::PostFieldSize(body.length()));
+		list<string> headers;
+		headers.push_back("Content-Type: application/json");
+		headers.push_back("Authorization: Bearer " + token());
 
-			ostringstream os_response;
-			r.setOpt(new curlpp::options::WriteStream(&os_response));
+		string body;
 
-			r.perform();
-			string response_data = os_response.str();
+		string response_data = http_session::instance().post(url, headers, body).body;
 
-			if (debug) cout << "Response:    " << response_data << endl;
-			if (!parse_result(response_data)) throw runtime_error("wake_up failed");
+		if (debug) log_line() << "Response:    " << response_data;
+		if (!parse_result(response_data)) throw runtime_error("wake_up failed");
 
-			int timeout = 5;
-			while (true) {
-				this_thread::sleep_for(chrono::seconds(15));
+		int timeout = 5;
+		while (true) {
+			this_thread::sleep_for(chrono::seconds(15));
+			try {
 				if (available(vin)) return;
-				if (--timeout == 0) throw runtime_error("Could not wake car");
 			}
+			catch (http_error &e) {
+				if (e.status() != 408) throw; // Still asleep
+			}
+			if (--timeout == 0) throw runtime_error("Could not wake car");
 		}
-		catch (std::exception &e) {
-			std::cerr << "Error: " << e.what() << std::endl;
-			if (--timeout == 0) throw;
-		}
-		std::this_thread::sleep_for(std::chrono::minutes(1));
-	}
+	});
 }
 
-void tesla_api::start_charge(std::string vin)
-{
-	int timeout = 10;
-	while (true) {
-		try {
-			string url = account.tesla_proxy + "/api/1/vehicles/" + vin + "/command/charge_start";
-			if (debug) cout << "url     :    " << url << endl;
-
-			curlpp::Cleanup clean;
-			curlpp::Easy r;
-			r.setOpt(new curlpp::options::Url(url));
-
-			list<string> headers;
-			headers.push_back("Content-Type: application/json");
-			headers.push_back("Authorization: Bearer " + m_token);
-			r.setOpt(new curlpp::options::HttpHeader(headers));
-
-			string body;
-			r.setOpt(new curlpp::options::PostFields(body));
-			r.setOpt(new curlpp::options::PostFieldSize(body.length()));
-
-			ostringstream os_response;
-			r.setOpt(new curlpp::options::WriteStream(&os_response));
-
-			r.perform();
-			string response_data = os_response.str();
-
-			if (debug) cout << "Response:    " << response_data << endl;
-			if (!parse_result(response_data)) throw runtime_error("start_charge failed");
-			break;
-		}
-		catch (std::exception &e) {
-			std::cerr << "Error: " << e.what() << std::endl;
-			if (--timeout == 0) throw;
-		}
-		std::this_thread::sleep_for(std::chrono::minutes(1));
-	}
-}
 
 string tesla_api::vehicle_data(string vin)
 {
-	int timeout = 10;
-	while (true) {
-		try {
-			string url = account.tesla_audience + "/api/1/vehicles/" + vin + "/vehicle_data?endpoints=" + curlpp::escape("charge_state;drive_state;location_data"); 
-			if (debug) cout << "url     :    " << url << endl;
-
-			curlpp::Cleanup clean;
-			curlpp::Easy r;
-			r.setOpt(new curlpp::options::Url(url));
-
-			list<string> headers;
-			headers.push_back("Content-Type: application/json");
-			headers.push_back("Authorization: Bearer " + m_token);
-			r.setOpt(new curlpp::options::HttpHeader(headers));
-
-			ostringstream os_response;
-			r.setOpt(new curlpp::options::WriteStream(&os_response));
-
-			r.perform();
-			string response_data = os_response.str();
-			if (response_data.size() == 0) throw runtime_error("No reply from server");
-
-			if (debug) cout << "Response:    " << response_data << endl;
-			return response_data;
-		}
-		catch (std::exception &e) {
-			std::cerr << "Error: " << e.what() << std::endl;
-			if (--timeout == 0) throw;
-		}
-		std::this_thread::sleep_for(std::chrono::minutes(1));
-	}
-	return {};
+	return retry(retry_policy(), [&]() {
+		string url = account.tesla_audience + "/api/1/vehicles/" + vin + "/vehicle_data?endpoints=" + curlpp::escape("charge_state;drive_state;location_data"); 
+		if (debug) log_line() << "url     :    " << url;
+
+		list<string> headers;
+		headers.push_back("Content-Type: application/json");
+		headers.push_back("Authorization: Bearer " + token());
+
+		string response_data = http_session::instance().get(url, headers).body;
+		if (response_data.size() == 0) throw runtime_error("No reply from server");
+
+		if (debug) log_line() << "Response:    " << response_data;
+		return response_data;
+	});
 }
 
-void tesla_api::set_charge_limit(std::string vin, int percent)
+
+std::string tesla_api::token() const
 {
-	int timeout = 10;
-	while (true) {
-		try {
-			string url = account.tesla_proxy + "/api/1/vehicles/" + vin + "/command/set_charge_limit";
-			if (debug) cout << "url     :    " << url << endl;
-
-			curlpp::Cleanup clean;
-			curlpp::Easy r;
-			r.setOpt(new curlpp::options::Url(url));
-
-			list<string> headers;
-			headers.push_back("Content-Type: application/json");
-			headers.push_back("Authorization: Bearer " + m_token);
-			r.setOpt(new curlpp::options::HttpHeader(headers));
-
-			string body;
-			body += '{';
-			body += "\"percent\": " + to_string(percent);
-			body += '}';
-			r.setOpt(new curlpp::options::PostFields(body));
-			r.setOpt(new curlpp::options::PostFieldSize(body.length()));
-
-			ostringstream os_response;
-			r.setOpt(new curlpp::options::WriteStream(&os_response));
-
-			r.perform();
-			string response_data = os_response.str();
-			if (response_data.size() == 0) throw runtime_error("No reply from server");
-
-			if (debug) cout << "Response:    " << response_data << endl;
-			if (!parse_result(response_data)) throw runtime_error("set_charge_limit failed");
-			break;
-		}
-		catch (std::exception &e) {
-			std::cerr << "Error: " << e.what() << std::endl;
-			if (--timeout == 0) throw;
-		}
-		std::this_thread::sleep_for(std::chrono::minutes(1));
-	}
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_token;
 }
 
 void tesla_api::start_proxy()
 {
+	std::lock_guard<std::mutex> lock(m_mutex);
 	if (m_proxy_started) return;
 
 	pid_t ppid_before_fork = getpid();
@@ -383,6 +269,20 @@ void tesla_api::start_proxy()
 	m_proxy_started = true;
 }
 
+void tesla_api::start_charge(std::string vin)
+{
+	queue({{ vin, "charge_start", "" }});
+}
+
+void tesla_api::set_charge_limit(std::string vin, int percent)
+{
+	string body;
+	body += '{';
+	body += "\"percent\": " + to_string(percent);
+	body += '}';
+	queue({{ vin, "set_charge_limit", body }});
+}
+
 void tesla_api::scheduled_departure(std::string vin, date::sys_time<std::chrono::system_clock::duration> end_off_peak_time, date::sys_time<std::chrono::system_clock::duration> next_event, bool preheat)
 {
 	// todo: zone should be tesla's time zone
@@ -390,89 +290,25 @@ void tesla_api::scheduled_departure(std::string vin, date::sys_time<std::chrono:
 	auto end_off_peak_m = std::chrono::duration_cast<std::chrono::minutes>(end_off_peak_time_local - date::floor<date::days>(end_off_peak_time_local));
 	auto next_event_local = date::make_zoned(date::current_zone(), next_event).get_local_time();
 	auto departure_m = std::chrono::duration_cast<std::chrono::minutes>(next_event_local - date::floor<date::days>(next_event_local));
-	int timeout = 10;
-	while (true) {
-		try {
-			string url = account.tesla_proxy + "/api/1/vehicles/" + vin + "/command/set_scheduled_charging";
-			if (debug) cout << "url     :    " << url << endl;
-
-			curlpp::Cleanup clean;
-			curlpp::Easy r;
-			r.setOpt(new curlpp::options::Url(url));
-
-			list<string> headers;
-			headers.push_back("Content-Type: application/json");
-			headers.push_back("Authorization: Bearer " + m_token);
-			r.setOpt(new curlpp::options::HttpHeader(headers));
-
-			string body;
-			body += '{';
-			body += "\"enable\": true";
-			body += ", \"time\": " + to_string(end_off_peak_m.count());
-			body += '}';
-			r.setOpt(new curlpp::options::PostFields(body));
-			r.setOpt(new curlpp::options::PostFieldSize(body.length()));
-
-			ostringstream os_response;
-			r.setOpt(new curlpp::options::WriteStream(&os_response));
-
-			r.perform();
-			string response_data = os_response.str();
-
-			if (debug) cout << "Response:    " << response_data << endl;
-			if (!parse_result(response_data)) throw runtime_error("set_scheduled_departure failed");
-			break;
-		}
-		catch (std::exception &e) {
-			std::cerr << "Error: " << e.what() << std::endl;
-			if (--timeout == 0) throw;
-		}
-		std::this_thread::sleep_for(std::chrono::minutes(1));
-	}
-	timeout = 10;
-	while (true) {
-		try {
-			string url = account.tesla_proxy + "/api/1/vehicles/" + vin + "/command/set_scheduled_departure";
-			if (debug) cout << "url     :    " << url << endl;
-
-			curlpp::Cleanup clean;
-			curlpp::Easy r;
-			r.setOpt(new curlpp::options::Url(url));
-
-			list<string> headers;
-			headers.push_back("Content-Type: application/json");
-			headers.push_back("Authorization: Bearer " + m_token);
-			r.setOpt(new curlpp::options::HttpHeader(headers));
-
-			string body;
-			body += '{';
-			body += "\"enable\": true";
-			body += ", \"off_peak_charging_enabled\": false";
-			body += ", \"preconditioning_enabled\": "; body += (preheat ? "true" : "false");
-			body += ", \"preconditioning_weekdays_only\": false";
-			body += ", \"off_peak_charging_weekdays_only\": false";
-			body += ", \"departure_time\": " + to_string(departure_m.count());
-			body += ", \"end_off_peak_time\": " + to_string(end_off_peak_m.count());
-			body += '}';
-			r.setOpt(new curlpp::options::PostFields(body));
-			r.setOpt(new curlpp::options::PostFieldSize(body.length()));
-
-			ostringstream os_response;
-			r.setOpt(new curlpp::options::WriteStream(&os_response));
-
-			r.perform();
-			string response_data = os_response.str();
-
-			if (debug) cout << "Response:    " << response_data << endl;
-			if (!parse_result(response_data)) throw runtime_error("set_scheduled_departure failed");
-			break;
-		}
-		catch (std::exception &e) {
-			std::cerr << "Error: " << e.what() << std::endl;
-			if (--timeout == 0) throw;
-		}
-		std::this_thread::sleep_for(std::chrono::minutes(1));
-	}
+
+	string charging_body;
+	charging_body += '{';
+	charging_body += "\"enable\": true";
+	charging_body += ", \"time\": " + to_string(end_off_peak_m.count());
+	charging_body += '}';
+
+	string departure_body;
+	departure_body += '{';
+	departure_body += "\"enable\": true";
+	departure_body += ", \"off_peak_charging_enabled\": false";
+	departure_body += ", \"preconditioning_enabled\": "; departure_body += (preheat ? "true" : "false");
+	departure_body += ", \"preconditioning_weekdays_only\": false";
+	departure_body += ", \"off_peak_charging_weekdays_only\": false";
+	departure_body += ", \"departure_time\": " + to_string(departure_m.count());
+	departure_body += ", \"end_off_peak_time\": " + to_string(end_off_peak_m.count());
+	departure_body += '}';
+
+	queue({{ vin, "set_scheduled_charging", charging_body }, { vin, "set_scheduled_departure", departure_body }});
 }
 
 void tesla_api::scheduled_charging(std::string vin, date::sys_time<std::chrono::system_clock::duration> time, date::sys_time<std::chrono::system_clock::duration> next_event)
@@ -485,89 +321,7 @@ void tesla_api::scheduled_charging(std::string vin, date::sys_time<std::chrono::
 	auto next_event_local = date::make_zoned(date::current_zone(), next_event).get_local_time();
 	auto departure_m = std::chrono::duration_cast<std::chrono::minutes>(next_event_local - date::floor<date::days>(next_event_local));
 
-	int timeout = 10;
-	while (true) {
-		try {
-			string url = account.tesla_proxy + "/api/1/vehicles/" + vin + "/command/set_scheduled_departure";
-			if (debug) cout << "url     :    " << url << endl;
-
-			curlpp::Cleanup clean;
-			curlpp::Easy r;
-			r.setOpt(new curlpp::options::Url(url));
-
-			list<string> headers;
-			headers.push_back("Content-Type: application/json");
-			headers.push_back("Authorization: Bearer " + m_token);
-			r.setOpt(new curlpp::options::HttpHeader(headers));
-
-			string body;
-			body += '{';
-			body += "\"enable\": false";
-			body += ", \"off_peak_charging_enabled\": false";
-			body += ", \"preconditioning_enabled\": false";
-			body += ", \"preconditioning_weekdays_only\": false";
-			body += ", \"off_peak_charging_weekdays_only\": false";
-			body += ", \"departure_time\": " + to_string(departure_m.count());
-			body += ", \"end_off_peak_time\": " + to_string(departure_m.count());
-			body += '}';
-			r.setOpt(new curlpp::options::PostFields(body));
-			r.setOpt(new curlpp::options::PostFieldSize(body.length()));
-
-			ostringstream os_response;
-			r.setOpt(new curlpp::options::WriteStream(&os_response));
-
-			r.perform();
-			string response_data = os_response.str();
-
-			if (debug) cout << "Response:    " << response_data << endl;
-			if (!parse_result(response_data)) throw runtime_error("set_scheduled_charging failed");
-			break;
-		}
-		catch (std::exception &e) {
-			std::cerr << "Error: " << e.what() << std::endl;
-			if (--timeout == 0) throw;
-		}
-		std::this_thread::sleep_for(std::chrono::minutes(1));
-	}
-	timeout = 10;
-	while (true) {
-		try {
-			string url = account.tesla_proxy + "/api/1/vehicles/" + vin + "/command/set_scheduled_charging";
-			if (debug) cout << "url     :    " << url << endl;
-
-			curlpp::Cleanup clean;
-			curlpp::Easy r;
-			r.setOpt(new curlpp::options::Url(url));
-
-			list<string> headers;
-			headers.push_back("Content-Type: application/json");
-			headers.push_back("Authorization: Bearer " + m_token);
-			r.setOpt(new curlpp::options::HttpHeader(headers));
-
-			string body;
-			body += '{';
-			body += "\"enable\": true";
-			body += ", \"time\": " + to_string(m.count());
-			body += '}';
-			r.setOpt(new curlpp::options::PostFields(body));
-			r.setOpt(new curlpp::options::PostFieldSize(body.length()));
-
-			ostringstream os_response;
-			r.setOpt(new curlpp::options::WriteStream(&os_response));
-
-			r.perform();
-			string response_data = os_response.str();
-
-			if (debug) cout << "Response:    " << response_data << endl;
-			if (!parse_result(response_data)) throw runtime_error("scheduled_charging failed");
-			break;
-		}
-		catch (std::exception &e) {
-			std::cerr << "Error: " << e.what() << std::endl;
-			if (--timeout == 0) throw;
-		}
-		std::this_thread::sleep_for(std::chrono::minutes(1));
-	}
+	queue({{ vin, "set_scheduled_departure", departure_disable_body(departure_m) }, { vin, "set_scheduled_charging", charging_body(true, m) }});
 }
 
 void tesla_api::scheduled_disable(std::string vin, date::sys_time<std::chrono::system_clock::duration> time, date::sys_time<std::chrono::system_clock::duration> next_event)
@@ -580,88 +334,102 @@ void tesla_api::scheduled_disable(std::string vin, date::sys_time<std::chrono::s
 	auto next_event_local = date::make_zoned(date::current_zone(), next_event).get_local_time();
 	auto departure_m = std::chrono::duration_cast<std::chrono::minutes>(next_event_local - date::floor<date::days>(next_event_local));
 
-	int timeout = 10;
-	while (true) {
-		try {
-			string url = account.tesla_proxy + "/api/1/vehicles/" + vin + "/command/set_scheduled_departure";
-			if (debug) cout << "url     :    " << url << endl;
-
-			curlpp::Cleanup clean;
-			curlpp::Easy r;
-			r.setOpt(new curlpp::options::Url(url));
-
-			list<string> headers;
-			headers.push_back("Content-Type: application/json");
-			headers.push_back("Authorization: Bearer " + m_token);
-			r.setOpt(new curlpp::options::HttpHeader(headers));
-
-			string body;
-			body += '{';
-			body += "\"enable\": false";
-			body += ", \"off_peak_charging_enabled\": false";
-			body += ", \"preconditioning_enabled\": false";
-			body += ", \"preconditioning_weekdays_only\": false";
-			body += ", \"off_peak_charging_weekdays_only\": false";
-			body += ", \"departure_time\": " + to_string(departure_m.count());
-			body += ", \"end_off_peak_time\": " + to_string(departure_m.count());
-			body += '}';
-			r.setOpt(new curlpp::options::PostFields(body));
-			r.setOpt(new curlpp::options::PostFieldSize(body.length()));
-
-			ostringstream os_response;
-			r.setOpt(new curlpp::options::WriteStream(&os_response));
-
-			r.perform();
-			string response_data = os_response.str();
-
-			if (debug) cout << "Response:    " << response_data << endl;
-			if (!parse_result(response_data)) throw runtime_error("set_scheduled_disabled failed");
-			break;
-		}
-		catch (std::exception &e) {
-			std::cerr << "Error: " << e.what() << std::endl;
-			if (--timeout == 0) throw;
-		}
-		std::this_thread::sleep_for(std::chrono::minutes(1));
+	queue({{ vin, "set_scheduled_departure", departure_disable_body(departure_m) }, { vin, "set_scheduled_charging", charging_body(false, m) }});
+}
+
+void tesla_api::begin_batch()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_batch[std::this_thread::get_id()].clear();
+}
+
+std::vector<command_result> tesla_api::commit()
+{
+	std::vector<command> commands;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto i = m_batch.find(std::this_thread::get_id());
+		if (i == m_batch.end()) return {};
+		commands = std::move(i->second);
+		m_batch.erase(i);
 	}
-	timeout = 10;
-	while (true) {
-		try {
-			string url = account.tesla_proxy + "/api/1/vehicles/" + vin + "/command/set_scheduled_charging";
-			if (debug) cout << "url     :    " << url << endl;
-
-			curlpp::Cleanup clean;
-			curlpp::Easy r;
-			r.setOpt(new curlpp::options::Url(url));
-
-			list<string> headers;
-			headers.push_back("Content-Type: application/json");
-			headers.push_back("Authorization: Bearer " + m_token);
-			r.setOpt(new curlpp::options::HttpHeader(headers));
-
-			string body;
-			body += '{';
-			body += "\"enable\": false";
-			body += ", \"time\": " + to_string(m.count());
-			body += '}';
-			r.setOpt(new curlpp::options::PostFields(body));
-			r.setOpt(new curlpp::options::PostFieldSize(body.length()));
-
-			ostringstream os_response;
-			r.setOpt(new curlpp::options::WriteStream(&os_response));
-
-			r.perform();
-			string response_data = os_response.str();
-
-			if (debug) cout << "Response:    " << response_data << endl;
-			if (!parse_result(response_data)) throw runtime_error("set_scheduled_disabled failed");
-			break;
+	return send(commands);
+}
+
+void tesla_api::discard_batch()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_batch.erase(std::this_thread::get_id());
+}
+
+void tesla_api::queue(std::vector<command> commands)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto i = m_batch.find(std::this_thread::get_id());
+		if (i != m_batch.end()) {
+			const int group = i->second.empty() ? 0 : i->second.back().group + 1;
+			for (auto &c : commands) {
+				c.group = group;
+				i->second.push_back(c);
+			}
+			return;
 		}
-		catch (std::exception &e) {
-			std::cerr << "Error: " << e.what() << std::endl;
-			if (--timeout == 0) throw;
+	}
+
+	// Not batching. Send now.
+	for (auto &r : send(commands)) {
+		if (!r.ok) throw runtime_error(r.name + " failed: " + r.error);
+	}
+}
+
+// Send commands back-to-back. Each pass sends all commands not yet done. A failing command doesn't
+// hold back the others, except the rest of its group which depends on it and waits for the next pass.
+std::vector<command_result> tesla_api::send(const std::vector<command> &commands)
+{
+	std::vector<command_result> results;
+	for (auto &c : commands) results.push_back({ c.vin, c.name, false, "Not sent" });
+	std::vector<bool> fatal(commands.size(), false); // failed in a way retrying won't fix
+
+	retry_policy policy;
+	for (int pass = 1; ; ++pass) {
+		bool done = true;
+		int failed_group = -1;
+		for (size_t i = 0; i < commands.size(); ++i) {
+			if (results[i].ok) continue;
+			if (fatal[i] || commands[i].group == failed_group) {
+				failed_group = commands[i].group;
+				continue;
+			}
+			try {
+				send(commands[i]);
+				results[i].ok = true;
+				results[i].error.clear();
+			}
+			catch (std::exception &e) {
+				log_line(std::cerr) << "Error: " << e.what();
+				results[i].error = e.what();
+				fatal[i] = !retryable(e);
+				failed_group = commands[i].group;
+				if (!fatal[i]) done = false;
+			}
 		}
-		std::this_thread::sleep_for(std::chrono::minutes(1));
+		if (done || pass >= policy.attempts || !retry_wait(policy, pass)) break;
 	}
+	return results;
 }
 
+void tesla_api::send(const command &c)
+{
+	string url = account.tesla_proxy + "/api/1/vehicles/" + c.vin + "/command/" + c.name;
+	if (debug) log_line() << "url     :    " << url;
+
+	list<string> headers;
+	headers.push_back("Content-Type: application/json");
+	headers.push_back("Authorization: Bearer " + token());
+
+	string response_data = http_session::instance().post(url, headers, c.body).body;
+
+	if (debug) log_line() << "Response:    " << response_data;
+	if (!parse_result(response_data)) throw runtime_error(c.name + " failed");
+}
@@ -21,10 +21,22 @@
 #define __TESLA_API_H
 
 #include <string>
+#include <vector>
+#include <map>
 #include <chrono>
+#include <mutex>
+#include <thread>
 #include <date/date.h>
 #include <date/tz.h>
 
+struct command_result
+{
+	std::string vin;
+	std::string name;
+	bool ok;
+	std::string error;
+};
+
 class tesla_api
 {
 	public:
@@ -38,12 +50,48 @@ class tesla_api
 	void scheduled_charging(std::string vin, date::sys_time<std::chrono::system_clock::duration> time, date::sys_time<std::chrono::system_clock::duration> next_event);
 	void scheduled_disable(std::string vin, date::sys_time<std::chrono::system_clock::duration> time, date::sys_time<std::chrono::system_clock::duration> next_event);
 
+	// Queue the commands from this thread until commit(), which sends them back-to-back and
+	// reports the result of each. A failing command is retried without holding back the others.
+	void begin_batch();
+	std::vector<command_result> commit();
+	void discard_batch(); // Drop the queued commands, if any, and stop batching
+
 	protected:
+	struct command
+	{
+		std::string vin;
+		std::string name;
+		std::string body;
+		int group; // Commands from one call. Sent in order
+	};
+
 	std::string m_token;
+	mutable std::mutex m_mutex; // api is shared by the car worker threads
+	std::map<std::thread::id, std::vector<command>> m_batch;
 	bool m_proxy_started { false };
 	pid_t m_proxy_pid;
 
 	void start_proxy();
+	std::string token() const;
+	void queue(std::vector<command> commands);
+	std::vector<command_result> send(const std::vector<command> &commands);
+	void send(const command &c);
+};
+
+// Batches the commands from this thread while it exists. Commands not committed are dropped when
+// it is destroyed, e.g. when an error stops a car early, so they are not sent with the next batch.
+class command_batch
+{
+	public:
+	explicit command_batch(tesla_api &api) : m_api(api) { m_api.begin_batch(); }
+	~command_batch() { m_api.discard_batch(); }
+	command_batch(const command_batch &) = delete;
+	command_batch &operator=(const command_batch &) = delete;
+
+	std::vector<command_result> commit() { return m_api.commit(); }
+
+	protected:
+	tesla_api &m_api;
 };
 
 #endif
@@ -17,23 +17,27 @@
  ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
  *************************************************************************/
  
-#include "icalendarlib/icalendar.h"
+#include "calendar.h"
 #include "vehicle_data.h"
 #include "el_price.h"
 #include "graph.h"
 #include "location.h"
-#include "ReverseGeocode.hpp"
+#include "place.h"
 #include "tesla-api.h"
+#include "record_store.h"
+#include "charge_window.h"
+#include "http.h"
+#include "retry.h"
+#include "scheduler.h"
+#include "shared_once.h"
+#include "json_records.h"
+#include "log.h"
 
 #include <date/date.h>
 #include <date/tz.h>
 
 #include <curlpp/cURLpp.hpp>
-#include <curlpp/Options.hpp>
-#include <curlpp/Easy.hpp>
 #include <rapidjson/document.h>
-#include <boost/python.hpp>
-#include <boost/algorithm/string.hpp>
 
 #include <string>
 #include <sstream>
@@ -43,45 +47,33 @@
 #include <vector>
 #include <algorithm>
 #include <list>
+#include <map>
+#include <tuple>
+#include <mutex>
 #include <iostream>
 #include <thread>
+#include <atomic>
+#include <functional>
+#include <cctype>
+#include <array>
+
+#include <stdlib.h>
+#include <unistd.h>
 
 #include "config.inc"
 
 constexpr int max_charge_hours = 6;
+constexpr std::chrono::minutes daemon_watch_interval { 5 }; // Daemon polls calendars and prices for changes
+constexpr std::chrono::minutes token_retry { 5 };           // Daemon retries a failed token refresh after this
+constexpr std::chrono::hours calendar_look_ahead { 48 };    // Events later than this are not planned for yet
+constexpr std::chrono::minutes calendar_reuse { 10 };       // Cars evaluated within this share a calendar sync
+constexpr bool save_vehicle_json = false;                   // Also save the raw vehicle data in /var/tmp/tesla-cron for debugging
 
 constexpr int charge_now_limit       = 30;   // Start charge now below this level
 constexpr int charge_limit_min       = 50;   // Charge level at charge now
 constexpr int charge_limit_scheduled = 70;   // Charge level at cheapest price
 constexpr int charge_limit_depart    = 80;   // Charge level at calendar event
 
-std::string get_area(const std::string& country, const location& loc)
-{
-	struct location_entry
-	{
-		location loc;
-		std::string country;
-		std::string area;
-	} location_map[] = {
-		{{55.306978, 10.805645}, "DK", "DK1"},  // Nyborg
-		{{55.357423, 11.117698}, "DK", "DK2"},  // Halsskov
-
-		{{57.398749, 14.682311}, "SE", "SE3"},  // Approximation. Where is the exact SE3/SE4 zone?
-		{{57.391515, 14.680349}, "SE", "SE4"},  // Approximation. Where is the exact SE3/SE4 zone?
-
-		{{00.000000, 00.000000}, "NO", "NO2"},  // Only one zone for norway?
-	};
-
-	location_entry found = location_map[0];
-	for (auto& l : location_map) {
-                if (l.country != country) continue;
-		if (found.area.empty() || distance(loc, l.loc) < distance(loc, found.loc)) {
-			found = l;
-		}
-	}
-	return found.area;
-}
-
 vehicle_data parse_vehicle_data(std::string data)
 {
 	using namespace rapidjson;
@@ -155,33 +147,16 @@ vehicle_data parse_vehicle_data(std::string data)
 	return vd;
 }
 
-int get_vehicle_index(const boost::python::object &vehicles, std::string vin)
-{
-	using namespace boost::python;
-
-	auto vehicle_count = len(vehicles);
-	int index = -1;
-	for (int i = 0; i < vehicle_count; ++i) {
-		object summary = vehicles[i].attr("get_vehicle_summary")();
-		//std::cout << "summary " << i << ": " << extract<std::string>(str(summary))() << std::endl;
-		if (extract<std::string>(str(summary))().find(vin) != std::string::npos) {
-			index = i;
-			break;
-		}
-
-	}
-	if (index == -1) throw std::runtime_error("vin not found");
-	return index;
-}
-
+// Raw vehicle data, only kept for debugging
 void save_vehicle_data(std::string vin, std::string data)
 {
 	std::string f_path = "/var/tmp/tesla-cron";
-	std::string f_name = f_path + "/tesla-" + vin + ".cache";
+	std::string f_name = f_path + "/tesla-" + vin + ".json";
 	std::ofstream f(f_name);
 	f << data;
 }
 
+// Raw vehicle data saved by versions before the snapshot
 std::string load_vehicle_data(std::string vin)
 {
 	std::string f_path = "/var/tmp/tesla-cron";
@@ -195,29 +170,35 @@ std::string load_vehicle_data(std::string vin)
 vehicle_data get_vehicle_data(tesla_api &api, std::string vin)
 {
 	auto data = api.vehicle_data(vin);
-	save_vehicle_data(vin, data);
-	return parse_vehicle_data(data);
+	if (save_vehicle_json) save_vehicle_data(vin, data);
+	auto vd = parse_vehicle_data(data);
+	vd.updated = std::chrono::system_clock::now();
+	save_vehicle_snapshot(vd);
+	return vd;
 }
 
 vehicle_data get_vehicle_data_from_cache(tesla_api &api, std::string vin)
 {
-	auto data = load_vehicle_data(vin);
 	vehicle_data ret;
+	if (load_vehicle_snapshot(vin, ret)) return ret;
+
+	// Without a snapshot, use the cache of an older version once instead of waking the car
 	try {
-		ret = parse_vehicle_data(data);
+		ret = parse_vehicle_data(load_vehicle_data(vin)); // Time of reading is not known
+		save_vehicle_snapshot(ret);
+		return ret;
 	}
 	catch (std::exception &e) {
-		std::cerr << "Cache: " << e.what() << std::endl;
-		// need to get from car if cache is invalid
-		api.wake_up(vin);
-		data = api.vehicle_data(vin); 
-		ret = parse_vehicle_data(data);
+		log_line(std::cerr) << "Cache: " << e.what();
 	}
-	return ret;
+
+	// need to get from car if cache is invalid
+	api.wake_up(vin);
+	return get_vehicle_data(api, vin);
 }
 
 
-std::string download_tarif_prices_energidataservice(std::string net, std::chrono::time_point<std::chrono::system_clock> from, std::chrono::time_point<std::chrono::system_clock> to)
+http_stream download_tarif_prices_energidataservice(std::string net, std::chrono::time_point<std::chrono::system_clock> from, std::chrono::time_point<std::chrono::system_clock> to)
 {
    // Ensure begin_time is first day of month because some tarif entries has a begin date of first day of month.
    // Round up end time to end of day / start of next day
@@ -226,210 +207,210 @@ std::string download_tarif_prices_energidataservice(std::string net, std::chrono
    std::string filter = "{\"ChargeOwner\":[\"" + net + "\"],\"Note\":[\"Nettarif C\",\"Nettarif C time\"]}";
    std::string url = "https://api.energidataservice.dk/dataset/DatahubPricelist?&start=" + from_ss.str() + "&end=" + to_ss.str() + "&filter=" + curlpp::escape(filter) + "&sort=ValidFrom%20DESC&timezone=utc";
 
-   curlpp::Cleanup clean;
-   curlpp::Easy r;
-   r.setOpt(new curlpp::options::Url(url));
-
-   std::ostringstream response;
-   r.setOpt(new curlpp::options::WriteStream(&response));
-
-   r.perform();
-   std::string response_str = response.str();
-   if (response_str.size() == 0) throw std::runtime_error("No prices from server");
-
-   return response_str;
+   return http_stream(url);
 }
 
-std::string download_el_prices_energidataservice(std::string area)
+http_stream download_el_prices_energidataservice(std::string area, std::chrono::time_point<std::chrono::system_clock> from)
 {
    std::string filter = "{\"PriceArea\":[\"" + area + "\"]}";
-   std::string url = "https://api.energidataservice.dk/dataset/Elspotprices?limit=100&filter=" + curlpp::escape(filter);
-
-   curlpp::Cleanup clean;
-   curlpp::Easy r;
-   r.setOpt(new curlpp::options::Url(url));
-
-   std::ostringstream response;
-   r.setOpt(new curlpp::options::WriteStream(&response));
-
-   r.perform();
-   std::string response_str = response.str();
-   if (response_str.size() == 0) throw std::runtime_error("No prices from server");
+   // Day ahead prices are 15 minutes since October 2025. 400 prices is about 4 days.
+   std::string url = "https://api.energidataservice.dk/dataset/DayAheadPrices?limit=400&filter=" + curlpp::escape(filter);
+   if (from != std::chrono::time_point<std::chrono::system_clock>()) {
+      // Only prices from 'from' and forward
+      std::stringstream from_ss; from_ss << date::format("%Y-%m-%dT%H:%M", date::floor<std::chrono::minutes>(from));
+      url += "&start=" + from_ss.str() + "&timezone=utc";
+   }
 
-   return response_str;
+   return http_stream(url);
 }
 
-std::string download_el_prices_carnot(std::string area)
+http_stream download_el_prices_carnot(std::string area)
 {
    std::transform(area.begin(), area.end(), area.begin(), ::tolower);
 
    std::string url = "https://whale-app-dquqw.ondigitalocean.app/openapi/get_predict?energysource=spotprice&region=" + area + "&daysahead=7";
 
-   curlpp::Cleanup clean;
-   curlpp::Easy r;
-   r.setOpt(new curlpp::options::Url(url));
-
    std::list<std::string> headers;
    headers.push_back("accept: application/json");
    headers.push_back("apikey: " + account.carnot_apikey);
    headers.push_back("username: " + account.email);
-   r.setOpt(new curlpp::options::HttpHeader(headers));
-
-   std::ostringstream response;
-   r.setOpt(new curlpp::options::WriteStream(&response));
 
-   r.perform();
-   std::string response_str = response.str();
-   if (response_str.size() == 0) throw std::runtime_error("No prices from server");
-
-   return response_str;
+   return http_stream(url, headers);
 }
 
-std::pair<price_list, float> parse_el_prices_energidataservice(std::string str, std::string area)
+// Records are parsed as they are received
+std::pair<price_list, float> parse_el_prices_energidataservice(http_stream &in, std::string area)
 {
-	using namespace rapidjson;
 	price_list prices;
+	if (in.Peek() == '\0') throw std::runtime_error("No prices from server");
 
-	Document doc;
-	doc.Parse(str.c_str());
-        if (!doc.IsObject() || !doc.HasMember("records")) throw std::runtime_error("No prices found (no records)"); 
-	const Value &elspotprices = doc["records"];
-	if (!elspotprices.IsArray()) throw std::runtime_error("No prices found (no records array)");
 	std::chrono::time_point<std::chrono::system_clock> last_time;
         float dk_eur { NAN };
-	for (auto &i : elspotprices.GetArray()) {
-		const Value &time = i["HourUTC"];
-		if (!time.IsString()) throw std::runtime_error("Unexpected time format");
-		const Value &price = i["SpotPriceEUR"];
-	 	if (!price.IsNumber()) throw std::runtime_error("Unexpected price format");
-		const Value &v_area = i["PriceArea"];
-		if (!v_area.IsString()) throw std::runtime_error("Unexpected area format");
+	const bool found = read_json_records(in, "records", [&](const json_record &i) {
+		const json_field *time = i.find("TimeUTC");
+		if (!time || time->type != json_field::string_type) throw std::runtime_error("Unexpected time format");
+		const json_field *price = i.find("DayAheadPriceEUR");
+	 	if (!price || price->type != json_field::number_type) throw std::runtime_error("Unexpected price format");
+		const json_field *v_area = i.find("PriceArea");
+		if (!v_area || v_area->type != json_field::string_type) throw std::runtime_error("Unexpected area format");
 
                 // Validate area
-                if (v_area.GetString() != area) {
-                   std::cout << "Warning: Unexpected area (" << v_area.GetString() << ", " << area << ')' << std::endl;
-                   continue;
+                if (v_area->text != area) {
+                   log_line() << "Warning: Unexpected area (" << v_area->text << ", " << area << ')';
+                   return;
                 }
 
 		price_entry entry;
-		std::stringstream ss(time.GetString());
-		ss >> date::parse("%Y-%m-%dT%H:%M:%S", entry.time);
-		entry.price = price.GetFloat();
+		if (!parse_iso_time(time->text, entry.time)) throw std::runtime_error("Unexpected time format");
+		entry.price = price->number;
 		prices.push_back(entry);
 
                 // Save latest dk/eur exchange value for carnot
-		const Value &dkprice = i["SpotPriceDKK"];
-		if (!dkprice.IsNull()) { // some entries contains null price. Skip those.
+		const json_field *dkprice = i.find("DayAheadPriceDKK");
+		if (dkprice && dkprice->type != json_field::null_type) { // some entries contains null price. Skip those.
                    if (entry.time > last_time) {
-                      if (!dkprice.IsNumber()) throw std::runtime_error("Unexpected dkprice format");
-                      dk_eur = dkprice.GetFloat() / entry.price;
+                      if (dkprice->type != json_field::number_type) throw std::runtime_error("Unexpected dkprice format");
+                      dk_eur = dkprice->number / entry.price;
                       last_time = entry.time;
                    }
                 }
-	}
+	});
+        if (!found) throw std::runtime_error("No prices found (no records array)");
 
 	std::sort(prices.begin(), prices.end());
 
 	return {prices, dk_eur};
 }
 
-price_list parse_tarif_prices_energidataservice(std::string str, std::string elnet, float dk_eur)
+// Records are parsed as they are received. Tarif responses are large, so they are never held in memory.
+tarif_list parse_tarif_prices_energidataservice(http_stream &in, std::string elnet)
 {
-   using namespace rapidjson;
-   price_list prices;
-
-   //std::cout << "in: " << str << std::endl;
-
-   Document doc;
-   doc.Parse(str.c_str());
-   if (!doc.IsObject() || !doc.HasMember("records")) throw std::runtime_error("No tarif prices found (no records)");
-   const Value& records = doc["records"];
-   if (!records.IsArray()) throw std::runtime_error("No tarif prices found (no array)");
-   for (auto& i : records.GetArray()) {
-      const Value& v_elnet = i["ChargeOwner"];
-      if (!v_elnet.IsString()) throw std::runtime_error("Unexpected ChargeOwner format");
-      const Value& v_from = i["ValidFrom"];
-      if (!v_from.IsString()) throw std::runtime_error("Unexpected ValidFrom format");
-      const Value& v_to = i["ValidTo"];
-      const Value& v_gln = i["GLN_Number"];
-      if (v_gln.IsNull()) continue; // Dublicate entries seen with Trefor, with gln=null on one of them. Skip those.
-      std::vector<float> hour_prices;
+   tarif_list tarifs;
+   if (in.Peek() == '\0') throw std::runtime_error("No prices from server");
+
+   static const auto price_keys = []() {
+      std::array<std::string, 24> keys;
+      for (int h = 0; h < 24; ++h) keys[h] = "Price" + std::to_string(h+1);
+      return keys;
+   }();
+
+   const bool found = read_json_records(in, "records", [&](const json_record &i) {
+      const json_field *v_elnet = i.find("ChargeOwner");
+      if (!v_elnet || v_elnet->type != json_field::string_type) throw std::runtime_error("Unexpected ChargeOwner format");
+      const json_field *v_from = i.find("ValidFrom");
+      if (!v_from || v_from->type != json_field::string_type) throw std::runtime_error("Unexpected ValidFrom format");
+      const json_field *v_to = i.find("ValidTo");
+      const json_field *v_gln = i.find("GLN_Number");
+      if (v_gln && v_gln->type == json_field::null_type) return; // Dublicate entries seen with Trefor, with gln=null on one of them. Skip those.
+      tarif_record tarif;
       for (int h = 0; h < 24; ++h) {
-         auto key = std::string("Price") + to_string(h+1);
-         const Value& v_hour_price = i[key.c_str()];
-         if (!v_hour_price.IsNumber()) throw std::runtime_error("Unexpected Price format");
-         hour_prices.push_back(v_hour_price.GetDouble());
+         const json_field *v_hour_price = i.find(price_keys[h].c_str());
+         if (!v_hour_price || v_hour_price->type != json_field::number_type) throw std::runtime_error("Unexpected Price format");
+         tarif.price[h] = v_hour_price->number;
       }
 
       // Get from and to date. Time = 00:00
       // The 00:00 start time is CET time zone (with DST).
-      const char tarif_zone[] = "CET";
-      date::local_time<std::chrono::system_clock::duration> time_from_local, time_to_local;
-      std::stringstream ss_from(v_from.GetString());
-      ss_from >> date::parse("%Y-%m-%dT", time_from_local);
-
-      if (v_to.IsString()) { // ValidTo may be missing
-	      std::stringstream ss_to(v_to.GetString());
-	      ss_to >> date::parse("%Y-%m-%dT", time_to_local);
+      if (!parse_iso_day(v_from->text, tarif.valid_from)) throw std::runtime_error("Unexpected ValidFrom format");
+
+      tarif.valid_to = tarif_record::open_end; // ValidTo may be missing
+      if (v_to && v_to->type == json_field::string_type) {
+	      if (!parse_iso_day(v_to->text, tarif.valid_to)) throw std::runtime_error("Unexpected ValidTo format");
       }
-      else {
-         // Use 90 days from now if ValidTo is missing
-         time_to_local = date::locate_zone(tarif_zone)->to_local(std::chrono::system_clock::now()) + date::days(90); 
+
+      tarifs.push_back(tarif);
+   });
+   if (!found) throw std::runtime_error("No tarif prices found (no array)");
+
+   return tarifs;
+}
+
+// Expand tarifs to hourly prices from-to (both included). Only the days in the window are expanded,
+// and the newest tarif is used where ranges overlap. prices is cleared but keeps its capacity, so
+// a reused buffer does not allocate.
+void expand_tarif_prices(const tarif_list &tarifs, float dk_eur, std::chrono::time_point<std::chrono::system_clock> from, std::chrono::time_point<std::chrono::system_clock> to, price_list &prices)
+{
+   prices.clear();
+
+   const auto zone = date::locate_zone("CET");
+   // Use 90 days from now if ValidTo is missing
+   const auto open_end_local = zone->to_local(std::chrono::system_clock::now()) + date::days(90);
+   // Start a day early. With DST the hours of a day may begin before local midnight of from.
+   const auto day_from = date::floor<date::days>(zone->to_local(from)) - date::days(1);
+   const auto day_to = date::floor<date::days>(zone->to_local(to));
+   prices.reserve((day_to - day_from).count() * 24 + 24);
+
+   for (auto d = day_from; d <= day_to; d += date::days(1)) {
+      const int32_t day = d.time_since_epoch().count();
+      const tarif_record *found = nullptr;
+      for (auto& tarif : tarifs) {
+         const bool valid = tarif.valid_from <= day && (tarif.valid_to == tarif_record::open_end ? d < open_end_local : day < tarif.valid_to);
+         if (valid && (!found || tarif.valid_from > found->valid_from)) found = &tarif;
       }
+      if (!found) continue;
 
-      // std::cout << "entry: " << v_from.GetString() << " -> "  << (v_to.IsString() ? v_to.GetString() : "...") << std::endl;
-      // todo: limit time span. Could be large
-      for (auto d = time_from_local; d < time_to_local; d += std::chrono::hours(24)) {
-         price_entry entry;
-         entry.time = date::make_zoned(tarif_zone, d).get_sys_time();
-         for (auto p : hour_prices) {
+      price_entry entry;
+      entry.time = cet_day_start(day);
+      for (auto p : found->price) {
+         if (entry.time >= from && entry.time <= to) {
             entry.price = p * 1000.0 / dk_eur; // convert dkk/kwh to eur/mwh
             prices.push_back(entry);
             // std::cout << "tarif: " << date::make_zoned(date::current_zone(), entry.time) << ": " << entry.price << std::endl;
-            entry.time += std::chrono::hours(1);
          }
+         entry.time += std::chrono::hours(1);
       }
    }
+}
 
-   std::sort(prices.begin(), prices.end());
-
-   return prices;
+// True if the stored tarifs cover all days from-to. Open ended tarifs may get an end date
+// when new tarifs are published, so those are only trusted for a day after download.
+bool tarif_covers(const record_store<tarif_record> &store, std::chrono::time_point<std::chrono::system_clock> from, std::chrono::time_point<std::chrono::system_clock> to)
+{
+   const auto now = std::chrono::system_clock::now();
+   const bool fresh = now - store.updated < std::chrono::hours(24);
+   const auto zone = date::locate_zone("CET");
+   const int32_t day_from = date::floor<date::days>(zone->to_local(from)).time_since_epoch().count();
+   const int32_t day_to = date::floor<date::days>(zone->to_local(to)).time_since_epoch().count();
+   for (int32_t day = day_from; day <= day_to; ++day) {
+      auto covered = std::find_if(store.rows.begin(), store.rows.end(), [day, fresh](const tarif_record &t) {
+         return t.valid_from <= day && day < t.valid_to && (fresh || t.valid_to != tarif_record::open_end);
+      });
+      if (covered == store.rows.end()) return false;
+   }
+   return true;
 }
 
-price_list parse_el_prices_carnot(std::string str, std::string area, float dk_eur)
+// Prices are in DKK. They are converted when the exchange rate from the spot prices is known.
+price_list parse_el_prices_carnot(http_stream &in, std::string area)
 {
-	using namespace rapidjson;
 	price_list prices;
-
-	Document doc;
-	doc.Parse(str.c_str());
-        if (!doc.IsObject() || !doc.HasMember("predictions")) throw std::runtime_error("No prices found (no predictions)");
-	const Value &elspotprices = doc["predictions"];
-	if (!elspotprices.IsArray()) throw std::runtime_error("No prices found (no predictions array)");
-	for (auto &i : elspotprices.GetArray()) {
-		const Value &v_time = i["utctime"];
-		if (!v_time.IsString()) throw std::runtime_error("Unexpected time format");
-		const Value &v_price = i["prediction"];
-	 	if (!v_price.IsNumber()) throw std::runtime_error("Unexpected price format");
-		const Value &v_area = i["pricearea"];
-		if (!v_area.IsString()) throw std::runtime_error("Unexpected area format");
-
-                std::string s_area = v_area.GetString();
+	if (in.Peek() == '\0') throw std::runtime_error("No prices from server");
+
+	std::string s_area;
+	const bool found = read_json_records(in, "predictions", [&](const json_record &i) {
+		const json_field *v_time = i.find("utctime");
+		if (!v_time || v_time->type != json_field::string_type) throw std::runtime_error("Unexpected time format");
+		const json_field *v_price = i.find("prediction");
+	 	if (!v_price || v_price->type != json_field::number_type) throw std::runtime_error("Unexpected price format");
+		const json_field *v_area = i.find("pricearea");
+		if (!v_area || v_area->type != json_field::string_type) throw std::runtime_error("Unexpected area format");
+
+                s_area = v_area->text;
                 std::transform(s_area.begin(), s_area.end(), s_area.begin(), ::toupper);
 
                 // Validate area
                 if (s_area != area) {
-                   std::cout << "Warning: Unexpected area (" << s_area << ", " << area << ')' << std::endl;
-                   continue;
+                   log_line() << "Warning: Unexpected area (" << s_area << ", " << area << ')';
+                   return;
                 }
 
 		price_entry entry;
-		std::stringstream ss(v_time.GetString());
-		ss >> date::parse("%Y-%m-%dT%H:%M:%S", entry.time);
-		entry.price = v_price.GetFloat() / dk_eur;
+		if (!parse_iso_time(v_time->text, entry.time)) throw std::runtime_error("Unexpected time format");
+		entry.price = v_price->number;
 
 		prices.push_back(entry);
-	}
+	});
+        if (!found) throw std::runtime_error("No prices found (no predictions array)");
 
 	std::sort(prices.begin(), prices.end());
 
@@ -438,94 +419,111 @@ price_list parse_el_prices_carnot(std::string str, std::string area, float dk_eu
 
 std::pair<price_list, float> get_el_prices_energidataservice(std::string area)
 {
-   int timeout = 10;
-   while (true) {
-      try {
-         auto data = download_el_prices_energidataservice(area);
-         return parse_el_prices_energidataservice(data, area);
-      }
-      catch (std::exception &e) {
-         std::cerr << "Error: " << e.what() << std::endl;
-         if (--timeout == 0) throw;
-      }
-      std::this_thread::sleep_for(std::chrono::minutes(1));
-   }
-   return {{}, NAN};
+   using namespace std::chrono;
+
+   record_store<price_entry> store("spot-" + area);
+   store.load();
+   store.rows = resample(store.rows, price_step(store.rows)); // Hourly prices saved before the 15 minute prices
+
+   // Keep a day of history
+   const auto now = system_clock::now();
+   store.rows.erase(store.rows.begin(), std::find_if(store.rows.begin(), store.rows.end(),
+            [&now](const price_entry &e) { return e.time + hours(24) > now; }));
+
+   // Day ahead prices are published once a day. Nothing new to get while known prices reach 12h ahead.
+   const bool have_prices = !store.rows.empty() && !std::isnan(store.value);
+   if (have_prices && store.rows.rbegin()->time >= now + hours(12)) return {store.rows, store.value};
+
+   // Only get hours after the last known one
+   auto from = have_prices ? store.rows.rbegin()->time + price_step(store.rows) : time_point<system_clock>();
+
+   return retry(retry_policy(), [&]() {
+      auto data = download_el_prices_energidataservice(area, from);
+      auto ret = parse_el_prices_energidataservice(data, area);
+      if (!have_prices) store.rows.clear();
+      for (auto& e : ret.first) if (store.rows.empty() || e > *store.rows.rbegin()) store.rows.push_back(e);
+      store.rows = resample(store.rows, price_step(store.rows)); // Prices are searched by a single step
+      if (!std::isnan(ret.second)) store.value = ret.second;
+      store.updated = now;
+      store.save();
+      return std::make_pair(store.rows, store.value);
+   });
 }
 
-price_list get_el_prices_carnot(std::string area, float dk_eur)
+price_list get_el_prices_carnot(std::string area)
 {
-   int timeout = 10;
-   while (true) {
-      try {
-         auto data_dk = download_el_prices_carnot(area);
-         return parse_el_prices_carnot(data_dk, area, dk_eur);
-      }
-      catch (std::exception &e) {
-         std::cerr << "Error: " << e.what() << std::endl;
-         if (--timeout == 0) throw;
-      }
-      std::this_thread::sleep_for(std::chrono::minutes(1));
-   }
-   return {};
+   return retry(retry_policy(), [&]() {
+      auto data_dk = download_el_prices_carnot(area);
+      return parse_el_prices_carnot(data_dk, area);
+   });
 }
 
-price_list get_tarif_prices_energidataservice(std::string elnet, std::chrono::time_point<std::chrono::system_clock> from, std::chrono::time_point<std::chrono::system_clock> to, float dk_eur)
+void get_tarif_prices_energidataservice(std::string elnet, std::chrono::time_point<std::chrono::system_clock> from, std::chrono::time_point<std::chrono::system_clock> to, float dk_eur, price_list &tarif)
 {
-   from -= date::days(370); // Valid from-to ranges seen at 6 months (Radius Elnet) Subtract a year to ensure from is before range start
-   int timeout = 10;
-   while (true) {
-      try {
-         auto data = download_tarif_prices_energidataservice(elnet, from, to);
-         return parse_tarif_prices_energidataservice(data, elnet, dk_eur);
-      }
-      catch (std::exception &e) {
-         std::cerr << "Error: " << e.what() << std::endl;
-         if (--timeout == 0) throw;
-      }
-      std::this_thread::sleep_for(std::chrono::minutes(1));
+   std::string store_name = "tarif-" + elnet;
+   std::replace_if(store_name.begin(), store_name.end(), [](char c) { return !std::isalnum(static_cast<unsigned char>(c)) && c != '-'; }, '_');
+   record_store<tarif_record> store(store_name);
+   store.load();
+
+   // Tarifs change rarely. Only download when the stored ones don't cover the requested time.
+   if (!tarif_covers(store, from, to)) {
+      auto download_from = from - date::days(370); // Valid from-to ranges seen at 6 months (Radius Elnet) Subtract a year to ensure from is before range start
+      retry(retry_policy(), [&]() {
+         auto data = download_tarif_prices_energidataservice(elnet, download_from, to);
+         store.rows = parse_tarif_prices_energidataservice(data, elnet);
+         store.updated = std::chrono::system_clock::now();
+         store.save();
+      });
    }
-   return {};
+
+   expand_tarif_prices(store.rows, dk_eur, from, to, tarif);
 }
 
+// Last spot price used for planning in each area. The daemon compares it with new downloads.
+static std::mutex spot_planned_mutex;
+static std::map<std::string, std::chrono::system_clock::time_point> spot_planned;
+
 price_list get_el_prices(std::string area, std::string elnet)
 {
+   // Carnot does not depend on the spot prices, so it is downloaded meanwhile
+   bool has_carnot = !account.carnot_apikey.empty();
+   std::future<price_list> carnot;
+   if (has_carnot) carnot = fetch_pool::instance().run([area]() { return get_el_prices_carnot(area); });
+
    auto ret = get_el_prices_energidataservice(area);
    auto prices = ret.first;
    auto dk_eur = ret.second;
+   const auto step = price_step(prices);
+   if (!prices.empty()) {
+      std::lock_guard<std::mutex> lock(spot_planned_mutex);
+      spot_planned[area] = prices.rbegin()->time;
+   }
    
-   bool has_carnot = !account.carnot_apikey.empty();
    if (has_carnot) {
-      auto prices_carnot = get_el_prices_carnot(area, dk_eur);
+      auto prices_carnot = carnot.get();
+      for (auto& e : prices_carnot) e.price /= dk_eur;
       if (prices_carnot.empty()) {
-         std::cout << "Error: Empty reply from Carnot." << std::endl;
+         log_line() << "Error: Empty reply from Carnot.";
          has_carnot = false;
       }
-      // Merge Carnot prices
+      // Merge Carnot prices. Carnot is hourly, so split to the spot price step first.
+      prices_carnot = resample(prices_carnot, step);
       for (auto& e : prices_carnot) if (e > *prices.rbegin()) prices.push_back(e);
    }
 
    if (!has_carnot) {
       // No Carnot. just add additianal 4 hours after known prices to allow charge window begin there if last known price is cheap.
       price_entry entry_est = *prices.rbegin();
-      for (int i = 0; i < 4; ++i) {
-         entry_est.time += std::chrono::hours(1);
+      for (int i = 0; i < std::chrono::hours(4) / step; ++i) {
+         entry_est.time += step;
          prices.push_back(entry_est);
       }
    }
 
    if (!elnet.empty()) {
-      auto tarif = get_tarif_prices_energidataservice(elnet, prices.begin()->time, prices.rbegin()->time, dk_eur);
-      // add tarif prices
-      for (auto& p : prices) {
-         auto i_t = std::find(tarif.begin(), tarif.end(), p);
-         if (i_t == tarif.end()) {
-            std::cout << "Error: No tarif price found for " << date::make_zoned(date::current_zone(), p.time) << std::endl;
-            continue;
-         }
-         p.price += i_t->price;
-         tarif.erase(i_t);
-      }
+      thread_local price_list tarif; // reused between calls
+      get_tarif_prices_energidataservice(elnet, prices.begin()->time, prices.rbegin()->time, dk_eur, tarif);
+      add_tarif_prices(prices, tarif);
    }
 
    // Convert prices to DKK
@@ -538,314 +536,480 @@ price_list get_el_prices(std::string area, std::string elnet)
    return prices;
 }
 
-std::chrono::time_point<std::chrono::system_clock> find_cheapest_start(const price_list &prices, int hours, const std::chrono::time_point<std::chrono::system_clock> &start, const std::chrono::time_point<std::chrono::system_clock> &stop)
+using el_price_key = std::tuple<std::string, std::string, std::chrono::time_point<std::chrono::system_clock, std::chrono::hours>>;
+static shared_once<el_price_key, price_list> el_price_cache;
+
+// Cars in the same area and elnet share prices. Each price set is fetched once per hour, and
+// concurrent requests for the same set wait for the first fetch instead of downloading again.
+price_list get_el_prices_shared(const std::string &area, const std::string &elnet)
 {
-	if (hours < 1) return stop; // return stop on 0 hours - no need to charge
-	if (prices.size() < 2) return stop - std::chrono::hours(hours); // nothing to compare with < two prices
-	auto found_start = stop - std::chrono::hours(hours); // keep window before stop if no seq is found (stop - start < hours)
-	float found_price_sum = std::numeric_limits<float>::max();
-	for (price_list::const_iterator i_beg = prices.begin(); i_beg != prices.end(); ++i_beg) {
-		if (std::distance(i_beg, prices.end()) < hours) break;      // stop if out of known hours
-		//if ((i_beg + hours - 1)->time >= stop) break;             // stop if seq ends after stop
-		if (i_beg->time + std::chrono::hours(hours) > stop) break;  // stop if seq ends after stop
-		if (i_beg->time + std::chrono::hours(1) <= start) continue; // skip if first hour ends before start
-		float price_sum = 0;
-		for (price_list::const_iterator i_seq = i_beg; i_seq != i_beg + hours; ++i_seq) price_sum += i_seq->price;
-		if (price_sum < found_price_sum) {
-			found_price_sum = price_sum;
-			found_start = i_beg->time;
-		}
-	}
-	return found_start;
+   const auto hour = date::floor<std::chrono::hours>(std::chrono::system_clock::now());
+   // Drop sets from previous hours
+   el_price_cache.erase_if([hour](const el_price_key &k, auto) { return std::get<2>(k) < hour; });
+   return el_price_cache.get({ area, elnet, hour }, [area, elnet]() { return get_el_prices(area, elnet); });
 }
 
-std::string download_calendar(std::string url)
+// True when there are newer spot prices for area than those last used for planning. Shared
+// price sets of the area are dropped, so cars get the new prices.
+bool el_prices_changed(const std::string &area)
 {
-	int timeout = 10;
-	while (true) {
-		try {
-			curlpp::Cleanup clean;
-			curlpp::Easy r;
-			r.setOpt(new curlpp::options::Url(url));
-			std::ostringstream response;
-			r.setOpt(new curlpp::options::WriteStream(&response));
-			r.perform();
-			std::string response_str = boost::replace_all_copy(response.str(), "\r\n", "\n");
-			return response_str;
-		}
-		catch (std::exception &e) {
-			std::cerr << "Error: " << e.what() << std::endl;
-			if (--timeout == 0) throw;
-		}
-		std::this_thread::sleep_for(std::chrono::minutes(1));
-	}
-	return std::string();
+   auto spot = get_el_prices_energidataservice(area).first;
+   if (spot.empty()) return false;
+   {
+      std::lock_guard<std::mutex> lock(spot_planned_mutex);
+      auto i = spot_planned.find(area);
+      if (i == spot_planned.end() || spot.rbegin()->time <= i->second) return false;
+   }
+   el_price_cache.erase_if([&area](const el_price_key &k, auto) { return std::get<0>(k) == area; });
+   return true;
 }
 
-date::sys_time<std::chrono::system_clock::duration> get_next_event(std::string cal_url, date::sys_time<std::chrono::system_clock::duration> from) 
+// Charge events of the calendar at url, covering the look ahead from from
+calendar_index get_calendar(std::string url, std::chrono::system_clock::time_point from)
 {
-        std::stringstream from_ss; from_ss << date::format("%Y%m%dT%H%M%S", from);
-	auto to = from + std::chrono::hours(48); // look two days ahead
-        std::stringstream to_ss; to_ss << date::format("%Y%m%dT%H%M%S", to);
+	calendar_index index(url);
+	index.sync(from, from + calendar_look_ahead);
+	return index;
+}
 
-	auto cal = download_calendar(cal_url);
-	{
-		std::ofstream os("/tmp/tesla_cron.ics");
-		os << cal;
-	}
+static shared_once<std::string, calendar_index> calendar_registry;
+
+// Cars often share a calendar. Each calendar is synced once per run, and concurrent requests
+// for it wait for the first sync instead of downloading again. The index covers more than the
+// look ahead, so each car can query its own time from the shared one.
+calendar_index get_calendar_shared(const std::string &url, std::chrono::system_clock::time_point from)
+{
+	// Drop calendars from previous runs
+	calendar_registry.erase_if([from](const std::string &, auto made) { return made + calendar_reuse < from; });
+	return calendar_registry.get(url, [url, from]() { return get_calendar(url, from); });
+}
 
-	ICalendar Calendar("/tmp/tesla_cron.ics");
-	ICalendar::Query SearchQuery(&Calendar);
-	SearchQuery.Criteria.From = from_ss.str();
-	SearchQuery.Criteria.To =   to_ss.str();
-	SearchQuery.ResetPosition();
+// True when the calendar differs from when it was last synced. A changed calendar is dropped
+// from the registry, so cars get the new events.
+bool calendar_changed(std::string url)
+{
+	const auto now = std::chrono::system_clock::now();
+	if (!calendar_index(url).sync(now, now + calendar_look_ahead)) return false;
+	calendar_registry.erase(url);
+	return true;
+}
 
-	auto found = to;
+struct car_plan
+{
+	std::chrono::system_clock::time_point next_run;   // When to evaluate the car again in daemon mode
+	std::string area;                                 // Price area of the car's location
+};
 
-	std::cout << "Upcoming events:" << std::endl;
+car_plan process_car(tesla_api &api, const car_data &car)
+{
+	auto now = std::chrono::system_clock::now();
+	log_scope out;
+
+	out << std::endl;
+	out << "--- " << car.vin << " ---" << std::endl;
+	out << "Now:        " << date::make_zoned(date::current_zone(), now) << std::endl;
+
+	// Calendars and prices don't depend on each other. The calendars download in the fetch pool while
+	// the prices download here, so a car waits for the slowest download instead of all of them in turn.
+	std::vector<std::future<calendar_index>> calendars;
+	for (auto &cal : car.calendars) calendars.push_back(fetch_pool::instance().run([&cal, now]() { return get_calendar_shared(cal, now); }));
+
+	auto vd_cached = get_vehicle_data_from_cache(api, car.vin);
+	auto place = get_place(vd_cached.drive_state.loc);
+
+	// Get prices from latest known location
+	const price_list el_prices = get_el_prices_shared(place.area, place.elnet);
+
+	auto next_event = now + std::chrono::hours(3 * 24); // latest time to schedule charging
+	out << "Upcoming events:" << std::endl;
+	for (auto &cal : calendars) {
+		auto index = cal.get();
+		for (auto &e : index.events(now, now + calendar_look_ahead)) out << "  " << date::make_zoned(date::current_zone(), e) << " [T]" << std::endl;
+		auto event = index.next_event(now, now + calendar_look_ahead);
+		next_event = std::min(next_event, event);
+	}
+	out << std::endl;
+
+	out << "Location:         " << place.country << '/' << place.area << ' ' << place.name << " (" << vd_cached.drive_state.loc.lat() << ", " << vd_cached.drive_state.loc.lon() << ")" << std::endl;
+        out << "Elnet:            " << place.elnet << std::endl;
+
+        out << "Prices:" << std::endl;
+        for(auto &i : el_prices) out << date::make_zoned(date::current_zone(), i.time) << ": " << i.price << std::endl; out << std::endl;
+	const auto el_price_step = price_step(el_prices);
+	auto el_price_now = std::find_if(el_prices.begin(), el_prices.end(), 
+			[&now, &el_price_step](const price_entry &a) { return (a.time + el_price_step) > now; });
+	if (el_price_now == el_prices.end()) throw std::runtime_error("No current el price");
+
+        // Test all charge hours to get earliest possible start time 
+	auto earliest_start_time = next_event;
+        int window_level_now = 0;
+	charge_window_search cheapest(el_prices);
+	auto cheapest_starts = cheapest.find_all(max_charge_hours, std::chrono::hours(1), now, next_event);
+	for (int hours = max_charge_hours; hours > 0; --hours) {
+		auto cs = cheapest_starts[hours - 1];
+		out << "Cheapest " << hours << "h seq:  " << date::make_zoned(date::current_zone(), cs) << std::endl;
+		earliest_start_time = std::min(earliest_start_time, cs);
+		if (cs <= now) window_level_now = max_charge_hours - hours + 1;
+	}
 
-	Event *i_event;
-	while ((i_event = SearchQuery.GetNextEvent(false)) != nullptr) {
-		std::cout << "  " << i_event->DtStart.Format() << " " << i_event->Summary << std::endl;
-		if (i_event->Summary.find("[T]") == std::string::npos) continue;
+	// At least hourly to keep the graph updated, and when the car may need to be woken up. See the sleeping state.
+	car_plan plan;
+	plan.area = place.area;
+	plan.next_run = date::floor<std::chrono::hours>(now) + std::chrono::hours(1) + std::chrono::minutes(1);
+	for (auto t : { earliest_start_time - std::chrono::hours(1), earliest_start_time - std::chrono::hours(24 - max_charge_hours), next_event - std::chrono::hours(20) }) {
+		if (t > now) plan.next_run = std::min(plan.next_run, t);
+	}
 
-		// convert to chrono
-		std::stringstream ss(i_event->DtStart);
-		date::local_time<std::chrono::system_clock::duration> event_local;
-		ss >> date::parse("%Y%m%dT%H%M%S", event_local);
-		std::string tzid = i_event->DtStart.tzid.empty() ? "UTC" : i_event->DtStart.tzid;
-		auto event = date::make_zoned(tzid, event_local).get_sys_time();
+        vehicle_data vd;
+        auto action_get_data = [&car, &vd, &api, &out]()
+        {
+           // wake up tesla
+           vd = get_vehicle_data(api, car.vin);
+           out << "Vin:              " << vd.vin << std::endl;
+           out << "Limit:            " << vd.charge_state.charge_limit_soc << std::endl;
+           out << "Level:            " << vd.charge_state.battery_level << std::endl;
+           out << "State:            " << vd.charge_state.charging_state << std::endl;
+           out << "Scheduled mode:   " << vd.charge_state.scheduled_charging_mode << std::endl;
+           out << "Moving:           " << vd.drive_state.moving << std::endl;
+           //out << "Scheduled start: " << date::make_zoned(date::current_zone(), vd.charge_state.scheduled_charging_start_time) << std::endl;
+        };
+
+        // Time to charge from current level to limit. Rounded up to whole price steps, and at least 1h (see plugged state).
+        // 0 when the level is an hour of charging or more above the limit, as with hourly prices before. No need to charge
+        // then, and find() returns the event time.
+        using hours_f = std::chrono::duration<float, std::ratio<3600>>;
+        auto charge_time = [&vd, &el_price_step](int limit)
+        {
+           auto t = std::chrono::duration_cast<std::chrono::minutes>(std::chrono::hours(max_charge_hours)) * (limit - vd.charge_state.battery_level) / 100;
+           if (t <= -std::chrono::hours(1)) return std::chrono::minutes(0);
+           return std::max<std::chrono::minutes>((t / el_price_step) * el_price_step + el_price_step, std::chrono::hours(1));
+        };
+
+        enum class state { init, sleeping, wake_up, update_data, start_charge, disconnected, plugged, charging, charging_depart_by, charging_scheduled_start, depart_by, scheduled_start, no_schedule, check_charge_limit_min, set_charge_limit_min, end };
+
+        state cur_state = state::init;
+        bool done = false;
+        command_batch batch(api); // car commands are sent together at end
+        std::chrono::time_point<std::chrono::system_clock> start_time;
+
+        while (!done) {
+           switch (cur_state) {
+              case state::init:
+                 out << "-> init" << std::endl;
+                 out << "Next event:       " << date::make_zoned(date::current_zone(), next_event) << std::endl;
+                 cur_state = api.available(car.vin) ? state::update_data : state::sleeping;
+                 break;
+              case state::sleeping:
+                 out << "-> sleeping" << std::endl;
+                 {
+                    out << "Level (cached):   " << vd_cached.charge_state.battery_level << std::endl;
+                    out << "Sched md (cached):" << vd_cached.charge_state.scheduled_charging_mode << std::endl;
+                    out << "Moving (cached):  " << vd_cached.drive_state.moving << std::endl;
+                    const bool in_scheduled_depart_window = (next_event < now + std::chrono::hours(20));
+                    const bool in_scheduled_charge_window = (earliest_start_time < now + std::chrono::hours(24 - max_charge_hours));
+                    cur_state = ( (earliest_start_time - std::chrono::hours(1) < now)    // Let car sleep until 1 hour before potential start. At this point we may need to start charging.
+                          || vd_cached.drive_state.moving                                // Ensure latest cached data is from parked state so we have a valid location.
+                          || (vd_cached.charge_state.battery_level < charge_now_limit) ) // wake up if battery level < charge_now_limit.
+                          || (in_scheduled_depart_window && ((vd_cached.charge_state.scheduled_charging_mode != "ChargeAt")
+					  		    || (vd.charge_state.charge_limit_soc < charge_limit_depart)))
+                          || (in_scheduled_charge_window && ((vd_cached.charge_state.scheduled_charging_mode != "ChargeAt")
+					  		    || (vd.charge_state.charge_limit_soc < charge_limit_scheduled)))
+                          || (!in_scheduled_depart_window && !in_scheduled_charge_window && vd_cached.charge_state.scheduled_charging_mode != "Off")
+                       ? state::wake_up : state::end;
+                 }
+                 break;
+              case state::wake_up:
+                 out << "-> wake_up" << std::endl;
+		 api.wake_up(car.vin);
+		 cur_state = state::update_data;
+		 break;
+              case state::update_data:
+                 out << "-> update_data" << std::endl;
+                 action_get_data();
+                 cur_state = vd.charge_state.charging_state == "Disconnected" ? state::disconnected
+                    : vd.charge_state.charging_state == "Charging" ? state::charging
+                    : vd.charge_state.battery_level < charge_now_limit ? state::start_charge
+                    : state::plugged;
+                 break;
+              case state::start_charge:
+                 out << "-> start_charge" << std::endl;
+                 api.start_charge(car.vin);
+                 cur_state = state::charging;
+                 break;
+              case state::disconnected:
+                 out << "-> disconnected" << std::endl;
+                 cur_state = state::check_charge_limit_min;
+                 break;
+              case state::plugged:
+                 out << "-> plugged" << std::endl;
+                 {
+                    // Rounded up to price steps. Result should be from 1 to max_charge_hours since those are included in initial guess.
+                    // max_charge_hours+1 is possible but unlikely (requires 0% level & 100% limit). Also charging at least 1h 
+                    // ensures scheduled charging is set 1h before event at latest, which reduces the maximum window after the event 
+                    // to 5h where charging will start when plugged in.
+                    auto scheduled_charge_time = charge_time(std::max(charge_limit_scheduled, vd.charge_state.charge_limit_soc));
+                    start_time = cheapest.find(scheduled_charge_time, now, next_event);
+                    out << "Cheapest start:   " << hours_f(scheduled_charge_time).count() << "h at " << date::make_zoned(date::current_zone(), start_time) << std::endl;
+
+                    // Use scheduled depart if < 20h from now.
+                    const bool in_scheduled_depart_window = (next_event < now + std::chrono::hours(20));
+                    // Scheduled charging must be set < 18h in the future. Otherwise it will start charging immediately.
+                    const bool in_scheduled_charge_window = (start_time < now + std::chrono::hours(24 - max_charge_hours));
+
+                    cur_state = in_scheduled_depart_window ? state::depart_by
+                       : in_scheduled_charge_window ? state::scheduled_start
+                       : state::no_schedule;
+                 }
+                 break;
+              case state::charging:
+                 out << "-> charging" << std::endl;
+                 {
+                    // Copy from plugged state
+                    auto scheduled_charge_time = charge_time(std::max(charge_limit_scheduled, vd.charge_state.charge_limit_soc));
+                    start_time = cheapest.find(scheduled_charge_time, now, next_event);
+                    out << "Cheapest start:   " << hours_f(scheduled_charge_time).count() << "h at " << date::make_zoned(date::current_zone(), start_time) << std::endl;
+
+                    // Use scheduled depart if < 20h from now.
+                    const bool in_scheduled_depart_window = (next_event < now + std::chrono::hours(20)) && (vd.charge_state.charge_limit_soc < charge_limit_depart);
+                    // Scheduled charging must be set < 18h in the future. Otherwise it will start charging immediately.
+                    const bool in_scheduled_charge_window = (start_time < now + std::chrono::hours(24 - max_charge_hours)) && (vd.charge_state.charge_limit_soc < charge_limit_scheduled);
+                    // don't interrupt charging, charging and limit could be started and set manually by user
+                    // but update charge limit (upwards only) if charging into scheduled window
+                    cur_state = in_scheduled_depart_window ? state::charging_depart_by
+                       : in_scheduled_charge_window ? state::charging_scheduled_start
+                       : state::end;
+                 }
+                 break;
+              case state::charging_depart_by:
+                 out << "-> charging_depart_by" << std::endl;
+                 api.set_charge_limit(car.vin, charge_limit_depart);
+                 api.start_charge(car.vin); // Start charge in the unlikely event charging has just stopped now.
+                 cur_state = state::end;
+              break;
+              case state::charging_scheduled_start:
+                 out << "-> charging_scheduled_start" << std::endl;
+                 api.set_charge_limit(car.vin, charge_limit_scheduled);
+                 api.start_charge(car.vin); // Start charge in the unlikely event charging has just stopped now.
+                 cur_state = state::end;
+              break;
+              case state::depart_by:
+                 out << "-> depart_by" << std::endl;
+                 {
+                    // Recalculate start time based on charge_limit_depart
+                    auto scheduled_depart_time = charge_time(std::max(charge_limit_depart, vd.charge_state.charge_limit_soc));
+                    start_time = cheapest.find(scheduled_depart_time, now, next_event);
+                    out << "Cheapest start:   " << hours_f(scheduled_depart_time).count() << "h at " << date::make_zoned(date::current_zone(), start_time) << std::endl;
+                 }
+                 api.set_charge_limit(car.vin, charge_limit_depart);
+                 api.scheduled_departure(car.vin, start_time, next_event, true);
+                 cur_state = state::end;
+                 break;
+              case state::scheduled_start:
+                 out << "-> scheduled_start" << std::endl;
+                 api.set_charge_limit(car.vin, charge_limit_scheduled);
+                 api.scheduled_charging(car.vin, start_time, next_event);
+                 cur_state = state::end;
+                 break;
+              case state::no_schedule:
+                 out << "-> no_schedule" << std::endl;
+                 api.scheduled_disable(car.vin, start_time, next_event);
+                 cur_state = state::end;
+                 break;
+              case state::check_charge_limit_min:
+                 out << "-> check_charge_limit_min" << std::endl;
+                 cur_state = 
+                    (vd.charge_state.charge_limit_soc > charge_limit_min) ? state::set_charge_limit_min
+                    : state::end;
+                 break;
+              case state::set_charge_limit_min:
+                 out << "-> set_charge_limit_min" << std::endl;
+                 api.set_charge_limit(car.vin, charge_limit_min);
+                 cur_state = state::end;
+                 break;
+              case state::end:
+                 out << "-> end" << std::endl;
+                 {
+                    bool commands_ok = true;
+                    for (auto &r : batch.commit()) {
+                       out << "Command:          " << r.name << (r.ok ? " ok" : " failed: " + r.error) << std::endl;
+                       commands_ok = commands_ok && r.ok;
+                    }
+                    if (!commands_ok) throw std::runtime_error("Commands failed");
+                 }
+                 if (vd.vin == car.vin) {                                // only when the car is online, see sleeping
+                    std::this_thread::sleep_for(std::chrono::minutes(1));   // give car time to start before get data
+                    vd = get_vehicle_data(api, car.vin); 			// update graph with charging state
+                 }
+                 graph(car.vin, el_price_now, el_prices.end(), el_price_step, plan.next_run, window_level_now, next_event, vd);
+                 done = true;
+                 break;
+           }
+        }
+        return plan;
+}
 
-		// The query may return events from past because it does not handle time zones.
-		if (event < from) continue;
+// Keep running, and evaluate each car when process_car asks for it, or when its calendars or
+// prices change. Prices, boundaries, connections and the access token stay in memory between runs.
+int run_daemon(tesla_api &api)
+{
+	scheduler sched(account.parallel_cars);
+
+	// Per car, guarded by cars_mutex
+	std::mutex cars_mutex;
+	std::vector<std::string> car_area(account.cars.size());
+	std::vector<bool> car_running(account.cars.size());
+	std::vector<bool> car_changed(account.cars.size());   // Inputs changed while running
+	std::vector<uint64_t> car_pending(account.cars.size()); // Latest scheduled evaluation. Others are dropped when they start
+
+	// Without a token no car can be handled. Retried soon on errors, and the daemon exits when the
+	// credentials are refused, so it can be restarted with new ones.
+	std::atomic<int> exit_code { 0 };
+	std::function<void()> refresh = [&api, &sched, &refresh, &exit_code]()
+	{
+		auto next = std::chrono::system_clock::now() + std::chrono::hours(1);
+		try {
+			set_retry_deadline(std::chrono::system_clock::now() + std::chrono::minutes(50));
+			api.refresh_token();
+		}
+		catch (std::exception &e) {
+			log_line(std::cerr) << "Error: " << e.what();
+			if (!retryable(e)) {
+				exit_code = 1;
+				sched.stop();
+				return;
+			}
+			next = std::chrono::system_clock::now() + token_retry;
+		}
+		sched.at(next, "token", refresh);
+	};
+	sched.at(std::chrono::system_clock::now() + std::chrono::hours(1), "token", refresh);
 
-		found = std::min(found, event);
+	// Called with cars_mutex locked. An evaluation already handed to a worker can't be replaced by the
+	// scheduler, so each one gets a number and only the latest one for a car is run.
+	std::function<void(size_t, std::chrono::system_clock::time_point)> schedule;
+	std::function<void(size_t, uint64_t)> evaluate = [&](size_t i, uint64_t pending)
+	{
+		const car_data &car = account.cars[i];
+		auto now = std::chrono::system_clock::now();
+		std::chrono::system_clock::time_point next_run = date::floor<std::chrono::hours>(now) + std::chrono::hours(1) + std::chrono::minutes(1);
+		{
+			std::lock_guard<std::mutex> lock(cars_mutex);
+			if (pending != car_pending[i] || car_running[i]) return;
+			car_running[i] = true;
+			car_changed[i] = false;
+		}
+		try {
+			set_retry_deadline(now + std::chrono::minutes(50));
+			auto plan = process_car(api, car);
+			next_run = plan.next_run;
+			std::lock_guard<std::mutex> lock(cars_mutex);
+			car_area[i] = plan.area;
+		}
+		catch (std::exception &e) {
+			log_line(std::cerr) << "Error: " << e.what();
+		}
+		std::lock_guard<std::mutex> lock(cars_mutex);
+		car_running[i] = false;
+		if (car_changed[i]) next_run = std::chrono::system_clock::now();
+		log_line() << "Next run:         " << car.vin << ' ' << date::make_zoned(date::current_zone(), next_run);
+		schedule(i, next_run);
+	};
+	schedule = [&](size_t i, std::chrono::system_clock::time_point when)
+	{
+		const uint64_t pending = ++car_pending[i];
+		sched.at(when, account.cars[i].vin, [&evaluate, i, pending]() { evaluate(i, pending); });
+	};
+	{
+		std::lock_guard<std::mutex> lock(cars_mutex);
+		for (size_t i = 0; i < account.cars.size(); ++i) schedule(i, std::chrono::system_clock::now());
 	}
 
-	return found;
+	// Poll calendars and spot prices. Calendars are conditional downloads, and spot prices are
+	// only downloaded when new ones are expected, so a poll without changes is cheap.
+	std::function<void()> watch = [&]()
+	{
+		std::map<std::string, bool> areas;
+		{
+			std::lock_guard<std::mutex> lock(cars_mutex);
+			for (auto &a : car_area) if (!a.empty()) areas[a] = false;
+		}
+		for (auto &a : areas) {
+			try {
+				a.second = el_prices_changed(a.first);
+				if (a.second) log_line() << "New prices:       " << a.first;
+			}
+			catch (std::exception &e) {
+				log_line(std::cerr) << "Error: " << e.what();
+			}
+		}
+
+		std::map<std::string, bool> calendars;
+		for (size_t i = 0; i < account.cars.size(); ++i) {
+			const car_data &car = account.cars[i];
+			bool changed = false;
+			for (auto &cal : car.calendars) {
+				if (calendars.count(cal) == 0) {
+					try {
+						calendars[cal] = calendar_changed(cal);
+					}
+					catch (std::exception &e) {
+						log_line(std::cerr) << "Error: " << e.what();
+						calendars[cal] = false;
+					}
+				}
+				changed = changed || calendars[cal];
+			}
+
+			std::lock_guard<std::mutex> lock(cars_mutex);
+			changed = changed || (!car_area[i].empty() && areas[car_area[i]]);
+			if (!changed) continue;
+			log_line() << "Inputs changed:   " << car.vin;
+			if (car_running[i]) car_changed[i] = true; // Evaluated again when done
+			else schedule(i, std::chrono::system_clock::now());
+		}
+
+		sched.at(std::chrono::system_clock::now() + daemon_watch_interval, "watch", watch);
+	};
+	sched.at(std::chrono::system_clock::now() + daemon_watch_interval, "watch", watch);
+
+	sched.run();
+	return exit_code;
 }
 
-int main()
+int main(int argc, char *argv[])
 {
+	const bool daemon = argc > 1 && std::string(argv[1]) == "--daemon";
+
 	mkdir("/var/tmp/tesla-cron", 0600);
-	
-	tesla_api api;
-	api.refresh_token();
 
-	Py_Initialize();
+	// Leave time to finish before next hourly run
+	set_retry_deadline(std::chrono::system_clock::now() + std::chrono::minutes(50));
 
-	for (auto &car : account.cars) {
-		try {
-			auto now = std::chrono::system_clock::now();
+	curlpp::Cleanup clean; // keep curl initialized while cars are processed in parallel
 
-			std::cout << std::endl;
-			std::cout << "--- " << car.vin << " ---" << std::endl;
-			std::cout << "Now:        " << date::make_zoned(date::current_zone(), now) << std::endl;
-			auto next_event = now + std::chrono::hours(3 * 24); // latest time to schedule charging
-			for (auto &cal : car.calendars) {
-				auto event = get_next_event(cal, now);
-				next_event = std::min(next_event, event);
+	tesla_api api;
+	api.refresh_token();
 
+	if (daemon) return run_daemon(api);
+
+	std::atomic<size_t> next_car { 0 };
+	auto worker = [&api, &next_car]()
+	{
+		for (size_t i; (i = next_car++) < account.cars.size(); ) {
+			try {
+				process_car(api, account.cars[i]);
 			}
-			std::cout << endl;
-
-                        ReverseGeocode geo;
-			auto vd_cached = get_vehicle_data_from_cache(api, car.vin);
-                        auto geoloc = geo.search(vd_cached.drive_state.loc.lat(), vd_cached.drive_state.loc.lon());
-                        if (geoloc.size() != 1) throw runtime_error("No location found");
-                        std::string country = geoloc[0]["cc"];
-                        std::string loc_name = geoloc[0]["name"];
-			auto area = get_area(country, vd_cached.drive_state.loc);
-                        auto elnet = get_elnet(vd_cached.drive_state.loc);
-			std::cout << "Location:         " << country << '/' << area << ' ' << loc_name << " (" << vd_cached.drive_state.loc.lat() << ", " << vd_cached.drive_state.loc.lon() << ")" << std::endl;
-                        std::cout << "Elnet:            " << elnet << std::endl;
-
-			// Get prices from latest known location
-                        price_list el_prices = get_el_prices(area, elnet);
-                        std::cout << "Prices:" << std::endl;
-                        for(auto &i : el_prices) std::cout << date::make_zoned(date::current_zone(), i.time) << ": " << i.price << std::endl; std::cout << std::endl;
-			auto el_price_now = std::find_if(el_prices.begin(), el_prices.end(), 
-					[&now](const price_entry &a) { return (a.time + std::chrono::hours(1)) > now; });
-			if (el_price_now == el_prices.end()) throw runtime_error("No current el price");
-
-                        // Test all charge hours to get earliest possible start time 
-			auto earliest_start_time = next_event;
-                        int window_level_now = 0;
-			for (int hours = max_charge_hours; hours > 0; --hours) {
-				auto cs = find_cheapest_start(el_prices, hours, now, next_event);
-				std::cout << "Cheapest " << hours << "h seq:  " << date::make_zoned(date::current_zone(), cs) << std::endl;
-				earliest_start_time = std::min(earliest_start_time, cs);
-				if (cs <= now) window_level_now = max_charge_hours - hours + 1;
+			catch (std::exception &e) {
+				log_line(std::cerr) << "Error: " << e.what();
 			}
-
-                        vehicle_data vd;
-                        auto action_get_data = [&car, &vd, &api]()
-                        {
-                           // wake up tesla
-                           vd = get_vehicle_data(api, car.vin);
-                           std::cout << "Vin:              " << vd.vin << std::endl;
-                           std::cout << "Limit:            " << vd.charge_state.charge_limit_soc << std::endl;
-                           std::cout << "Level:            " << vd.charge_state.battery_level << std::endl;
-                           std::cout << "State:            " << vd.charge_state.charging_state << std::endl;
-                           std::cout << "Scheduled mode:   " << vd.charge_state.scheduled_charging_mode << std::endl;
-                           std::cout << "Moving:           " << vd.drive_state.moving << std::endl;
-                           //std::cout << "Scheduled start: " << date::make_zoned(date::current_zone(), vd.charge_state.scheduled_charging_start_time) << std::endl;
-                        };
-
-                        enum class state { init, sleeping, wake_up, update_data, start_charge, disconnected, plugged, charging, charging_depart_by, charging_scheduled_start, depart_by, scheduled_start, no_schedule, check_charge_limit_min, set_charge_limit_min, end };
-
-                        state cur_state = state::init;
-                        bool done = false;
-                        std::chrono::time_point<std::chrono::system_clock> start_time;
-
-                        while (!done) {
-                           switch (cur_state) {
-                              case state::init:
-                                 std::cout << "-> init" << std::endl;
-                                 std::cout << "Next event:       " << date::make_zoned(date::current_zone(), next_event) << std::endl;
-                                 cur_state = api.available(car.vin) ? state::update_data : state::sleeping;
-                                 break;
-                              case state::sleeping:
-                                 std::cout << "-> sleeping" << std::endl;
-                                 {
-                                    std::cout << "Level (cached):   " << vd_cached.charge_state.battery_level << std::endl;
-                                    std::cout << "Sched md (cached):" << vd_cached.charge_state.scheduled_charging_mode << std::endl;
-                                    std::cout << "Moving (cached):  " << vd_cached.drive_state.moving << std::endl;
-                                    const bool in_scheduled_depart_window = (next_event < now + std::chrono::hours(20));
-                                    const bool in_scheduled_charge_window = (earliest_start_time < now + std::chrono::hours(24 - max_charge_hours));
-                                    cur_state = ( (earliest_start_time - std::chrono::hours(1) < now)    // Let car sleep until 1 hour before potential start. At this point we may need to start charging.
-                                          || vd_cached.drive_state.moving                                // Ensure latest cached data is from parked state so we have a valid location.
-                                          || (vd_cached.charge_state.battery_level < charge_now_limit) ) // wake up if battery level < charge_now_limit.
-                                          || (in_scheduled_depart_window && ((vd_cached.charge_state.scheduled_charging_mode != "ChargeAt")
-							  		    || (vd.charge_state.charge_limit_soc < charge_limit_depart)))
-                                          || (in_scheduled_charge_window && ((vd_cached.charge_state.scheduled_charging_mode != "ChargeAt")
-							  		    || (vd.charge_state.charge_limit_soc < charge_limit_scheduled)))
-                                          || (!in_scheduled_depart_window && !in_scheduled_charge_window && vd_cached.charge_state.scheduled_charging_mode != "Off")
-                                       ? state::wake_up : state::end;
-                                 }
-                                 break;
-                              case state::wake_up:
-                                 std::cout << "-> wake_up" << std::endl;
-				 api.wake_up(car.vin);
-				 cur_state = state::update_data;
-				 break;
-                              case state::update_data:
-                                 std::cout << "-> update_data" << std::endl;
-                                 action_get_data();
-                                 cur_state = vd.charge_state.charging_state == "Disconnected" ? state::disconnected
-                                    : vd.charge_state.charging_state == "Charging" ? state::charging
-                                    : vd.charge_state.battery_level < charge_now_limit ? state::start_charge
-                                    : state::plugged;
-                                 break;
-                              case state::start_charge:
-                                 std::cout << "-> start_charge" << std::endl;
-                                 api.start_charge(car.vin);
-                                 cur_state = state::charging;
-                                 break;
-                              case state::disconnected:
-                                 std::cout << "-> disconnected" << std::endl;
-                                 cur_state = state::check_charge_limit_min;
-                                 break;
-                              case state::plugged:
-                                 std::cout << "-> plugged" << std::endl;
-                                 {
-                                    // +1 is for rounding up. Result should be from 1 to max_charge_hours since those are included in initial guess.
-                                    // max_charge_hours+1 is possible but unlikely (requires 0% level & 100% limit). Also charging at least 1h 
-                                    // ensures scheduled charging is set 1h before event at latest, which reduces the maximum window after the event 
-                                    // to 5h where charging will start when plugged in.
-                                    int scheduled_charge_hours = (std::max(charge_limit_scheduled, vd.charge_state.charge_limit_soc) - vd.charge_state.battery_level) * max_charge_hours / 100 + 1;
-                                    start_time = find_cheapest_start(el_prices, scheduled_charge_hours, now, next_event);
-                                    std::cout << "Cheapest start:   " << scheduled_charge_hours << "h at " << date::make_zoned(date::current_zone(), start_time) << std::endl;
-
-                                    // Use scheduled depart if < 20h from now.
-                                    const bool in_scheduled_depart_window = (next_event < now + std::chrono::hours(20));
-                                    // Scheduled charging must be set < 18h in the future. Otherwise it will start charging immediately.
-                                    const bool in_scheduled_charge_window = (start_time < now + std::chrono::hours(24 - max_charge_hours));
-
-                                    cur_state = in_scheduled_depart_window ? state::depart_by
-                                       : in_scheduled_charge_window ? state::scheduled_start
-                                       : state::no_schedule;
-                                 }
-                                 break;
-                              case state::charging:
-                                 std::cout << "-> charging" << std::endl;
-                                 {
-                                    // Copy from plugged state
-                                    int scheduled_charge_hours = (std::max(charge_limit_scheduled, vd.charge_state.charge_limit_soc) - vd.charge_state.battery_level) * max_charge_hours / 100 + 1;
-                                    start_time = find_cheapest_start(el_prices, scheduled_charge_hours, now, next_event);
-                                    std::cout << "Cheapest start:   " << scheduled_charge_hours << "h at " << date::make_zoned(date::current_zone(), start_time) << std::endl;
-
-                                    // Use scheduled depart if < 20h from now.
-                                    const bool in_scheduled_depart_window = (next_event < now + std::chrono::hours(20)) && (vd.charge_state.charge_limit_soc < charge_limit_depart);
-                                    // Scheduled charging must be set < 18h in the future. Otherwise it will start charging immediately.
-                                    const bool in_scheduled_charge_window = (start_time < now + std::chrono::hours(24 - max_charge_hours)) && (vd.charge_state.charge_limit_soc < charge_limit_scheduled);
-                                    // don't interrupt charging, charging and limit could be started and set manually by user
-                                    // but update charge limit (upwards only) if charging into scheduled window
-                                    cur_state = in_scheduled_depart_window ? state::charging_depart_by
-                                       : in_scheduled_charge_window ? state::charging_scheduled_start
-                                       : state::end;
-                                 }
-                                 break;
-                              case state::charging_depart_by:
-                                 std::cout << "-> charging_depart_by" << std::endl;
-                                 api.set_charge_limit(car.vin, charge_limit_depart);
-                                 api.start_charge(car.vin); // Start charge in the unlikely event charging has just stopped now.
-                                 cur_state = state::end;
-                              break;
-                              case state::charging_scheduled_start:
-                                 std::cout << "-> charging_scheduled_start" << std::endl;
-                                 api.set_charge_limit(car.vin, charge_limit_scheduled);
-                                 api.start_charge(car.vin); // Start charge in the unlikely event charging has just stopped now.
-                                 cur_state = state::end;
-                              break;
-                              case state::depart_by:
-                                 std::cout << "-> depart_by" << std::endl;
-                                 {
-                                    // Recalculate start time based on charge_limit_depart
-                                    int scheduled_depart_hours = (std::max(charge_limit_depart, vd.charge_state.charge_limit_soc) - vd.charge_state.battery_level) * max_charge_hours / 100 + 1;
-                                    start_time = find_cheapest_start(el_prices, scheduled_depart_hours, now, next_event);
-                                    std::cout << "Cheapest start:   " << scheduled_depart_hours << "h at " << date::make_zoned(date::current_zone(), start_time) << std::endl;
-                                 }
-                                 api.set_charge_limit(car.vin, charge_limit_depart);
-                                 api.scheduled_departure(car.vin, start_time, next_event, true);
-                                 cur_state = state::end;
-                                 break;
-                              case state::scheduled_start:
-                                 std::cout << "-> scheduled_start" << std::endl;
-                                 api.set_charge_limit(car.vin, charge_limit_scheduled);
-                                 api.scheduled_charging(car.vin, start_time, next_event);
-                                 cur_state = state::end;
-                                 break;
-                              case state::no_schedule:
-                                 std::cout << "-> no_schedule" << std::endl;
-                                 api.scheduled_disable(car.vin, start_time, next_event);
-                                 cur_state = state::end;
-                                 break;
-                              case state::check_charge_limit_min:
-                                 std::cout << "-> check_charge_limit_min" << std::endl;
-                                 cur_state = 
-                                    (vd.charge_state.charge_limit_soc > charge_limit_min) ? state::set_charge_limit_min
-                                    : state::end;
-                                 break;
-                              case state::set_charge_limit_min:
-                                 std::cout << "-> set_charge_limit_min" << std::endl;
-                                 api.set_charge_limit(car.vin, charge_limit_min);
-                                 cur_state = state::end;
-                                 break;
-                              case state::end:
-                                 std::cout << "-> end" << std::endl;
-                                 std::this_thread::sleep_for(std::chrono::minutes(1));   // give car time to start before get data
-                                 vd = get_vehicle_data(api, car.vin); 			// update graph with charging state
-                                 graph(car.vin, *el_price_now, window_level_now, next_event, vd);
-                                 done = true;
-                                 break;
-                           }
-                        }
-		}
-		catch (std::exception &e) {
-			std::cerr << "Error: " << e.what() << std::endl;
 		}
-	}
+	};
+
+	std::vector<std::thread> workers;
+	const size_t worker_count = std::min<size_t>(account.parallel_cars, account.cars.size());
+	for (size_t i = 1; i < worker_count; ++i) workers.emplace_back(with_retry_deadline(worker));
+	worker();
+	for (auto &w : workers) w.join();
 
 	return 0;
 }
@@ -0,0 +1,131 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+#include "../ics.h"
+
+#include <date/date.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Calendars with known event starts. Returns 1 if ics_event_starts differs from any of them.
+
+typedef std::chrono::system_clock::time_point time_point;
+
+time_point utc(int y, unsigned m, unsigned d, int h, int mi = 0)
+{
+	return date::sys_days(date::year(y) / date::month(m) / date::day(d)) + std::chrono::hours(h) + std::chrono::minutes(mi);
+}
+
+std::string calendar(const std::vector<std::string> &lines)
+{
+	std::string cal = "BEGIN:VCALENDAR\r\nVERSION:2.0\r\n";
+	for (auto &l : lines) cal += l + "\r\n";
+	return cal + "END:VCALENDAR\r\n";
+}
+
+struct test_case
+{
+	const char *name;
+	std::string cal;
+	std::vector<time_point> expected;
+};
+
+void print(const char *what, const std::vector<time_point> &starts)
+{
+	std::cout << "  " << what << ":";
+	for (auto &t : starts) std::cout << " " << date::format("%F %T", date::floor<std::chrono::seconds>(t));
+	std::cout << std::endl;
+}
+
+int main()
+{
+	const std::vector<test_case> tests {
+		{ "weekly over start of DST", calendar({
+			"BEGIN:VEVENT", "UID:a", "SUMMARY:Work [charge]",
+			"DTSTART;TZID=Europe/Copenhagen:20240325T070000",
+			"RRULE:FREQ=WEEKLY;COUNT=3",
+			"END:VEVENT" }),
+			{ utc(2024, 3, 25, 6), utc(2024, 4, 1, 5), utc(2024, 4, 8, 5) } },
+
+		{ "until, exdate, moved and cancelled occurrences", calendar({
+			"BEGIN:VEVENT", "UID:b", "SUMMARY:[charge]",
+			"DTSTART:20240601T060000Z",
+			"RRULE:FREQ=DAILY;UNTIL=20240605T060000Z",
+			"EXDATE:20240603T060000Z",
+			"END:VEVENT",
+			"BEGIN:VEVENT", "UID:b", "SUMMARY:[charge]",
+			"RECURRENCE-ID:20240604T060000Z",
+			"DTSTART:20240604T090000Z",
+			"END:VEVENT",
+			"BEGIN:VEVENT", "UID:b", "SUMMARY:[charge]", "STATUS:CANCELLED",
+			"RECURRENCE-ID:20240602T060000Z",
+			"DTSTART:20240602T060000Z",
+			"END:VEVENT" }),
+			{ utc(2024, 6, 1, 6), utc(2024, 6, 4, 9), utc(2024, 6, 5, 6) } },
+
+		{ "untagged, all day and folded lines", calendar({
+			"BEGIN:VEVENT", "UID:c", "SUMMARY:Dentist",
+			"DTSTART:20240701T080000Z",
+			"END:VEVENT",
+			"BEGIN:VEVENT", "UID:d", "SUMMARY:Holiday [charge]",
+			"DTSTART;VALUE=DATE:20240702",
+			"END:VEVENT",
+			"BEGIN:VEVENT", "UID:e", "SUMMARY:Trip [cha",
+			" rge]",
+			"DTSTART:20240703T0",
+			" 80000Z",
+			"BEGIN:VALARM", "SUMMARY:Alarm", "TRIGGER:-PT15M", "DTSTART:20240101T000000Z", "END:VALARM",
+			"END:VEVENT" }),
+			{ utc(2024, 7, 3, 8) } },
+
+		{ "Windows zone name, as from Outlook", calendar({
+			"BEGIN:VTIMEZONE", "TZID:W. Europe Standard Time",
+			"BEGIN:STANDARD", "DTSTART:16010101T030000", "TZOFFSETFROM:+0200", "TZOFFSETTO:+0100", "END:STANDARD",
+			"END:VTIMEZONE",
+			"BEGIN:VEVENT", "UID:f", "SUMMARY:[charge] Office",
+			"DTSTART;TZID=W. Europe Standard Time:20241021T083000",
+			"RRULE:FREQ=WEEKLY;BYDAY=MO;COUNT=2",
+			"END:VEVENT" }),
+			{ utc(2024, 10, 21, 6, 30), utc(2024, 10, 28, 7, 30) } },
+
+		{ "zone by X-LIC-LOCATION, after the event", calendar({
+			"BEGIN:VEVENT", "UID:g", "SUMMARY:[charge]",
+			"DTSTART;TZID=/citadel.org/20190101_1/America/New_York:20241101T170000",
+			"RRULE:FREQ=WEEKLY;BYDAY=MO,TU,FR;COUNT=3",
+			"END:VEVENT",
+			"BEGIN:VTIMEZONE", "TZID:/citadel.org/20190101_1/America/New_York",
+			"X-LIC-LOCATION:America/New_York",
+			"END:VTIMEZONE" }),
+			{ utc(2024, 11, 1, 21), utc(2024, 11, 4, 22), utc(2024, 11, 5, 22) } },
+	};
+
+	size_t failed = 0;
+	for (auto &t : tests) {
+		const auto starts = ics_event_starts(t.cal, "[charge]", utc(2024, 1, 1, 0), utc(2025, 1, 1, 0));
+		if (starts == t.expected) continue;
+		std::cout << "Error: " << t.name << std::endl;
+		print("expected", t.expected);
+		print("got", starts);
+		++failed;
+	}
+	std::cout << "ics: " << tests.size() - failed << " of " << tests.size() << " ok" << std::endl;
+	return failed ? 1 : 0;
+}
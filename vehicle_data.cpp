@@ -0,0 +1,130 @@
+/*************************************************************************
+ ** Copyright (C) 2022 Jan Pedersen <jp@jp-embedded.com>
+ ** 
+ ** This file is part of tesla-cron.
+ ** 
+ ** tesla-cron is free software: you can redistribute it and/or modify 
+ ** it under the terms of the GNU General Public License as published by 
+ ** the Free Software Foundation, either version 3 of the License, or 
+ ** (at your option) any later version.
+ ** 
+ ** tesla-cron is distributed in the hope that it will be useful, 
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of 
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the 
+ ** GNU General Public License for more details.
+ ** 
+ ** You should have received a copy of the GNU General Public License 
+ ** along with tesla-cron. If not, see <https://www.gnu.org/licenses/>.
+ *************************************************************************/
+
+ 
+#include "vehicle_data.h"
+#include "atomic_file.h"
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace {
+
+const std::string snapshot_path = "/var/tmp/tesla-cron";
+
+const char snapshot_magic[4] = { 'T', 'C', 'V', 'D' };
+const uint32_t snapshot_version = 1;
+
+// Strings are \0 terminated
+struct snapshot_record
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t size;
+	int32_t charge_current_request;
+	int32_t charge_limit_soc;
+	int32_t battery_level;
+	char vin[32];
+	char charging_state[32];
+	char scheduled_charging_mode[32];
+	double lat;
+	double lon;
+	int64_t updated;     // seconds since epoch
+	uint8_t moving;
+	uint8_t reserved[7];
+};
+
+std::string snapshot_file(const std::string &vin)
+{
+	return snapshot_path + "/tesla-" + vin + ".bin";
+}
+
+bool get_text(const char (&field)[32], std::string &s)
+{
+	const size_t len = strnlen(field, sizeof(field));
+	if (len == sizeof(field)) return false;
+	s.assign(field, len);
+	return true;
+}
+
+void set_text(char (&field)[32], const std::string &s)
+{
+	if (s.size() >= sizeof(field)) throw std::runtime_error("Vehicle data too long for snapshot: " + s);
+	memcpy(field, s.c_str(), s.size() + 1);
+}
+
+}
+
+bool load_vehicle_snapshot(const std::string &vin, vehicle_data &vd)
+{
+	int fd = open(snapshot_file(vin).c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || size_t(st.st_size) != sizeof(snapshot_record)) {
+		close(fd);
+		return false;
+	}
+	void *data = mmap(nullptr, sizeof(snapshot_record), PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) return false;
+
+	const snapshot_record &r = *static_cast<const snapshot_record*>(data);
+	vehicle_data ret;
+	bool ok = memcmp(r.magic, snapshot_magic, sizeof(snapshot_magic)) == 0 && r.version == snapshot_version && r.size == sizeof(r);
+	ok = ok && get_text(r.vin, ret.vin) && ret.vin == vin;
+	ok = ok && get_text(r.charging_state, ret.charge_state.charging_state) && get_text(r.scheduled_charging_mode, ret.charge_state.scheduled_charging_mode);
+	if (ok) {
+		ret.charge_state.charge_current_request = r.charge_current_request;
+		ret.charge_state.charge_limit_soc = r.charge_limit_soc;
+		ret.charge_state.battery_level = r.battery_level;
+		ret.drive_state.loc = { r.lat, r.lon };
+		ret.drive_state.moving = r.moving != 0;
+		ret.updated = std::chrono::time_point<std::chrono::system_clock>(std::chrono::seconds(r.updated));
+	}
+	munmap(data, sizeof(snapshot_record));
+
+	if (ok) vd = std::move(ret);
+	return ok;
+}
+
+void save_vehicle_snapshot(const vehicle_data &vd)
+{
+	snapshot_record r {};
+	memcpy(r.magic, snapshot_magic, sizeof(snapshot_magic));
+	r.version = snapshot_version;
+	r.size = sizeof(r);
+	r.charge_current_request = vd.charge_state.charge_current_request;
+	r.charge_limit_soc = vd.charge_state.charge_limit_soc;
+	r.battery_level = vd.charge_state.battery_level;
+	set_text(r.vin, vd.vin);
+	set_text(r.charging_state, vd.charge_state.charging_state);
+	set_text(r.scheduled_charging_mode, vd.charge_state.scheduled_charging_mode);
+	r.lat = vd.drive_state.loc.lat();
+	r.lon = vd.drive_state.loc.lon();
+	r.updated = std::chrono::duration_cast<std::chrono::seconds>(vd.updated.time_since_epoch()).count();
+	r.moving = vd.drive_state.moving;
+
+	atomic_write_file(snapshot_file(vd.vin), std::string(reinterpret_cast<const char*>(&r), sizeof(r)));
+}
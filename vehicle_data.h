@@ -23,6 +23,7 @@
 #include "location.h"
 #include <string>
 #include <cmath>
+#include <chrono>
 
 struct vehicle_data
 {
@@ -41,8 +42,15 @@ struct vehicle_data
 		location loc;
                 bool moving;
 	} drive_state;
+	std::chrono::time_point<std::chrono::system_clock> updated;   // When read from the car
 
 };
 
+// Binary snapshot of the fields above in /var/tmp/tesla-cron, so a run can plan from the last
+// known state without waking the car. Saved with write-then-rename, so a crash never leaves a
+// partial snapshot. load returns false if there is no valid snapshot of vin.
+bool load_vehicle_snapshot(const std::string &vin, vehicle_data &vd);
+void save_vehicle_snapshot(const vehicle_data &vd);
+
 #endif
 